@@ -0,0 +1,158 @@
+/*
+ * bench/document.c: Measure line insertion and deletion in the middle of a
+ * large document.
+ *
+ * The document is filled with lines that point into a single buffer, either
+ * the contents of the file given on the command line or generated text of
+ * about 1 GB. Lines are then inserted and deleted around a cursor in the
+ * middle of the file, once using the gap buffer from document.c and once using
+ * a plain array that is moved on every edit, like the editor used to do.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../document.h"
+#include "../error.h"
+
+#define GENERATED_LINES 10000000
+#define GENERATED_LINE_LENGTH 100
+
+/* Edits done on the gap buffer and on the plain array respectively. */
+#define GAP_EDITS 1000000
+#define ARRAY_EDITS 200
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *load_text(const char *filename, size_t *length)
+{
+	if (filename == NULL) {
+		*length = (size_t)GENERATED_LINES * GENERATED_LINE_LENGTH;
+		char *text = malloc(*length);
+		if (text == NULL)
+			fatal_error("Failed to allocate %zu bytes\n", *length);
+		for (size_t i = 0; i < *length; i++)
+			text[i] = (i % GENERATED_LINE_LENGTH == GENERATED_LINE_LENGTH - 1) ? '\n' : 'a' + i % 26;
+		return text;
+	}
+
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1)
+		fatal_error("Failed to open %s\n", filename);
+
+	*length = st.st_size;
+	char *text = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (text == MAP_FAILED)
+		fatal_error("Failed to map %s\n", filename);
+	close(fd);
+	return text;
+}
+
+static void fill_line(line_t *line, char *chars, int size)
+{
+	memset(line, 0, sizeof(*line));
+	line->chars = chars;
+	line->size = size;
+}
+
+static void fill_document(struct document *document, char *text, size_t length)
+{
+	char *p = text;
+	char *end = text + length;
+	while (p < end) {
+		char *newline = memchr(p, '\n', end - p);
+		if (newline == NULL)
+			newline = end;
+		fill_line(document_insert(document, document_num_lines(document)), p, newline - p);
+		p = newline + 1;
+	}
+}
+
+/* Pick the next line to edit, wandering a little around the previous one. */
+static int next_position(int position, int num_lines)
+{
+	position += rand() % 64 - 32;
+	if (position < 0)
+		position = 0;
+	if (position > num_lines)
+		position = num_lines;
+	return position;
+}
+
+static double bench_gap_buffer(struct document *document, char *text, int edits)
+{
+	int position = document_num_lines(document) / 2;
+	double start = now();
+
+	for (int i = 0; i < edits; i++) {
+		position = next_position(position, document_num_lines(document) - 1);
+		if (i % 2 == 0)
+			fill_line(document_insert(document, position), text, 0);
+		else
+			document_remove(document, position);
+	}
+
+	return (now() - start) / edits;
+}
+
+static double bench_array(struct document *document, char *text, int edits)
+{
+	int num_lines = document_num_lines(document);
+	line_t *lines = malloc(sizeof(line_t) * num_lines);
+	for (int i = 0; i < num_lines; i++)
+		lines[i] = *document_get(document, i);
+
+	int position = num_lines / 2;
+	double start = now();
+
+	for (int i = 0; i < edits; i++) {
+		position = next_position(position, num_lines - 1);
+		if (i % 2 == 0) {
+			lines = realloc(lines, sizeof(line_t) * (num_lines + 1));
+			memmove(&lines[position + 1], &lines[position], sizeof(line_t) * (num_lines - position));
+			fill_line(&lines[position], text, 0);
+			num_lines++;
+		} else {
+			memmove(&lines[position], &lines[position + 1], sizeof(line_t) * (num_lines - position - 1));
+			num_lines--;
+		}
+	}
+
+	double elapsed = (now() - start) / edits;
+	free(lines);
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	size_t length;
+	char *text = load_text(argc >= 2 ? argv[1] : NULL, &length);
+
+	struct document document;
+	document_init(&document);
+
+	double start = now();
+	fill_document(&document, text, length);
+	printf("Indexed %d lines (%.0f MB) in %.2f s\n", document_num_lines(&document), length / 1e6, now() - start);
+
+	double gap = bench_gap_buffer(&document, text, GAP_EDITS);
+	printf("gap buffer:  %10.1f ns per line insert/delete\n", gap * 1e9);
+
+	double array = bench_array(&document, text, ARRAY_EDITS);
+	printf("plain array: %10.1f ns per line insert/delete\n", array * 1e9);
+
+	document_free(&document);
+	return 0;
+}
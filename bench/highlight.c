@@ -0,0 +1,106 @@
+/*
+ * bench/highlight.c: Measure how fast C source is highlighted.
+ *
+ * Highlights every line of the file given on the command line, or of a
+ * generated C corpus, several times over and reports lines per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../editor.h"
+#include "../error.h"
+#include "../syntax.h"
+
+#define GENERATED_COPIES 20000
+#define PASSES 5
+
+static const char *generated_source =
+	"#include <stdio.h>\n"
+	"\n"
+	"/*\n"
+	" * Count the words in a line of text, ignoring anything in quotes.\n"
+	" */\n"
+	"static int count_words(const char *text, unsigned long length)\n"
+	"{\n"
+	"\tint words = 0, in_word = 0;\n"
+	"\tfor (unsigned long i = 0; i < length; i++) {\n"
+	"\t\tif (text[i] == '\"' || text[i] == ' ') {\n"
+	"\t\t\tin_word = 0; // reset at separators\n"
+	"\t\t\tcontinue;\n"
+	"\t\t} else if (!in_word) {\n"
+	"\t\t\twords++;\n"
+	"\t\t\tin_word = 1;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\treturn words * 2 + 0x10 - 3.5;\n"
+	"}\n";
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *load_text(const char *filename, size_t *length)
+{
+	if (filename == NULL) {
+		size_t source_length = strlen(generated_source);
+		*length = source_length * GENERATED_COPIES;
+		char *text = malloc(*length);
+		for (int i = 0; i < GENERATED_COPIES; i++)
+			memcpy(&text[i * source_length], generated_source, source_length);
+		return text;
+	}
+
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL)
+		fatal_error("Failed to open %s\n", filename);
+	fseek(fp, 0, SEEK_END);
+	*length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	char *text = malloc(*length);
+	if (fread(text, 1, *length, fp) != *length)
+		fatal_error("Failed to read %s\n", filename);
+	fclose(fp);
+	return text;
+}
+
+int main(int argc, char **argv)
+{
+	size_t length;
+	char *text = load_text(argc >= 2 ? argv[1] : NULL, &length);
+
+	/* Let the editor pick and prepare the C rules, like it does for a file. */
+	struct editor_state editor;
+	memset(&editor, 0, sizeof(editor));
+	editor.filename = "bench.c";
+	editor_select_syntax_highlight(&editor);
+
+	unsigned char *highlight = malloc(length);
+	long lines = 0;
+	double start = now();
+
+	for (int pass = 0; pass < PASSES; pass++) {
+		int in_comment = 0;
+		char *p = text;
+		char *end = text + length;
+		while (p < end) {
+			char *newline = memchr(p, '\n', end - p);
+			if (newline == NULL)
+				newline = end;
+			in_comment = syntax_highlight_text(editor.syntax, p, newline - p, highlight, in_comment);
+			lines++;
+			p = newline + 1;
+		}
+	}
+
+	double elapsed = now() - start;
+	printf("Highlighted %ld lines in %.2f s: %.0f lines/s, %.1f MB/s\n",
+			lines, elapsed, lines / elapsed, length * PASSES / elapsed / 1e6);
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * bench/render.c: Measure how long it takes to draw a frame.
+ *
+ * Opens a 200x60 window with SDL's dummy video driver and software renderer
+ * (unless SDL_VIDEODRIVER or SDL_RENDER_DRIVER say otherwise), fills it with
+ * highlighted C source and redraws it while scrolling one line per frame,
+ * while typing into a line, and while nothing changes at all. Last, it
+ * redraws every row of the screen with a line of several megabytes on it, as
+ * in a minified file or a log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "../document.h"
+#include "../editor.h"
+#include "../highlight.h"
+#include "../syntax.h"
+#include "../window.h"
+
+#define ROWS 60
+#define COLS 200
+#define FRAMES 500
+#define LONG_LINE_SIZE (4 << 20)
+
+static const char *source_line =
+	"\tfor (int i = 0; i < count; i++) { total += values[i] * 2; /* keep a running sum */ "
+	"if (total > limit) return \"overflow\"; else if (flags & 0x10) continue; } // long line";
+
+static int compare_times(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void scroll_step(struct editor_state *editor, int frame)
+{
+	editor->cursor_y = frame + ROWS - 3;
+}
+
+static void type_step(struct editor_state *editor, int frame)
+{
+	editor_insert_char(editor, 'a' + frame % 26);
+}
+
+static void idle_step(struct editor_state *editor, int frame)
+{
+}
+
+static void redraw_step(struct editor_state *editor, int frame)
+{
+	editor_damage_all(editor);
+}
+
+static void wait_for_highlight(struct editor_state *editor)
+{
+	editor_request_highlight(editor);
+	while (editor->highlight_pending || editor->highlight_frontier < editor->num_lines) {
+		SDL_Delay(1);
+		editor_collect_highlight(editor);
+	}
+}
+
+/* Time FRAMES redraws, each after the editor has been changed by a step. */
+static void measure(const char *name, struct editor_state *editor, void (*step)(struct editor_state *, int))
+{
+	double *times = malloc(sizeof(double) * FRAMES);
+	double frequency = SDL_GetPerformanceFrequency();
+	double total = 0;
+
+	for (int frame = 0; frame < FRAMES; frame++) {
+		step(editor, frame);
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		window_redraw(editor);
+		times[frame] = (SDL_GetPerformanceCounter() - start) / frequency * 1e3;
+		total += times[frame];
+	}
+
+	qsort(times, FRAMES, sizeof(double), compare_times);
+	printf("%-6s %d frames of %dx%d: mean %.3f ms, median %.3f ms, p99 %.3f ms\n",
+			name, FRAMES, COLS, ROWS, total / FRAMES, times[FRAMES / 2], times[FRAMES * 99 / 100]);
+	free(times);
+}
+
+int main(int argc, char **argv)
+{
+	setenv("SDL_VIDEODRIVER", "dummy", 0);
+	setenv("SDL_RENDER_DRIVER", "software", 0);
+
+	window_init("Glypher benchmark", ROWS, COLS);
+
+	struct editor_state editor;
+	init_editor(&editor);
+	editor.filename = strdup("bench.c");
+	editor_select_syntax_highlight(&editor);
+
+	int num_lines = ROWS + FRAMES;
+	for (int i = 0; i < num_lines; i++)
+		editor_insert_line(&editor, i, (char *)source_line, strlen(source_line));
+
+	/* Wait for the whole file to be highlighted, so every frame is in colour. */
+	wait_for_highlight(&editor);
+
+	measure("scroll", &editor, scroll_step);
+
+	editor.cursor_x = 1;
+	editor_set_mode(&editor, EDITOR_MODE_INSERT);
+	measure("type", &editor, type_step);
+	measure("idle", &editor, idle_step);
+
+	size_t source_length = strlen(source_line);
+	char *long_line = malloc(LONG_LINE_SIZE);
+	for (size_t i = 0; i < LONG_LINE_SIZE; i++)
+		long_line[i] = source_line[i % source_length];
+	editor_set_mode(&editor, EDITOR_MODE_NORMAL);
+	editor_insert_line(&editor, editor.cursor_y, long_line, LONG_LINE_SIZE);
+	editor.cursor_x = 0;
+	free(long_line);
+	wait_for_highlight(&editor);
+	measure("long", &editor, redraw_step);
+
+	window_destroy();
+	editor_destroy(&editor);
+	return 0;
+}
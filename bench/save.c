@@ -0,0 +1,85 @@
+/*
+ * bench/save.c: Measure how long it takes to save a large file.
+ *
+ * Writes a file of the given size in gigabytes (2 by default) of generated
+ * lines, opens it, and times saving it unchanged, then again after editing
+ * every thousandth line. The file is removed afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+
+#include "../document.h"
+#include "../editor.h"
+#include "../file.h"
+#include "../line.h"
+#include "../window.h"
+
+#define DEFAULT_GIGABYTES 2
+#define DEFAULT_PATH "/tmp/glypher-save-bench.txt"
+#define EDIT_INTERVAL 1000
+
+static void generate_file(const char *path, size_t size)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	char line[128];
+	size_t written = 0;
+	for (long i = 0; written < size; i++) {
+		int length = snprintf(line, sizeof(line), "%ld: the quick brown fox jumps over the lazy dog\n", i);
+		fwrite(line, 1, length, file);
+		written += length;
+	}
+
+	fclose(file);
+}
+
+static void time_save(struct editor_state *editor, const char *name, size_t size)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	int error = file_save_current_file(editor);
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	if (error != 0) {
+		fprintf(stderr, "Saving failed: %s\n", strerror(error));
+		exit(1);
+	}
+	printf("%-10s %.3f s, %.1f MB/s\n", name, seconds, size / seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	double gigabytes = argc >= 2 ? atof(argv[1]) : DEFAULT_GIGABYTES;
+	const char *path = argc >= 3 ? argv[2] : DEFAULT_PATH;
+	size_t size = gigabytes * 1e9;
+
+	setenv("SDL_VIDEODRIVER", "dummy", 0);
+	setenv("SDL_RENDER_DRIVER", "software", 0);
+	window_init("Glypher benchmark", 28, 80);
+
+	generate_file(path, size);
+
+	struct editor_state editor;
+	init_editor(&editor);
+	editor_open(&editor, (char *)path);
+	printf("Saving %d lines, %.2f GB\n", editor.num_lines, size / 1e9);
+
+	time_save(&editor, "unchanged", size);
+
+	for (int j = 0; j < editor.num_lines; j += EDIT_INTERVAL)
+		line_insert_char(&editor, document_get(&editor.document, j), 0, '#');
+	size += (editor.num_lines + EDIT_INTERVAL - 1) / EDIT_INTERVAL;
+	time_save(&editor, "edited", size);
+
+	unlink(path);
+	window_destroy();
+	editor_destroy(&editor);
+	return 0;
+}
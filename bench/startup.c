@@ -0,0 +1,54 @@
+/*
+ * bench/startup.c: Measure how long it takes to get the first frame on screen.
+ *
+ * Times window_init up to the end of the first window_redraw, which is the
+ * first SDL_RenderPresent, with SDL's dummy video driver and software renderer
+ * (unless SDL_VIDEODRIVER or SDL_RENDER_DRIVER say otherwise). The cache
+ * starts out empty in a temporary directory, so the first run is cold and the
+ * others load the font atlas from the cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+
+#include "../editor.h"
+#include "../window.h"
+
+#define ROWS 28
+#define COLS 80
+#define DEFAULT_RUNS 5
+
+int main(int argc, char **argv)
+{
+	int runs = argc >= 2 ? atoi(argv[1]) : DEFAULT_RUNS;
+
+	setenv("SDL_VIDEODRIVER", "dummy", 0);
+	setenv("SDL_RENDER_DRIVER", "software", 0);
+
+	char cache_directory[] = "/tmp/glypher-bench-XXXXXX";
+	if (mkdtemp(cache_directory) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_CACHE_HOME", cache_directory, 1);
+
+	for (int run = 0; run < runs; run++) {
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		window_init("Glypher benchmark", ROWS, COLS);
+		struct editor_state editor;
+		init_editor(&editor);
+		editor_set_status_message(&editor, "HELP: Ctrl+Q: quit, Ctrl+S: save");
+		window_redraw(&editor);
+
+		double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency() * 1e3;
+		printf("run %d (%s cache): %.3f ms to the first frame\n", run + 1, run == 0 ? "cold" : "warm", elapsed);
+
+		window_destroy();
+		editor_destroy(&editor);
+	}
+
+	printf("Cache files were left in %s\n", cache_directory);
+	return 0;
+}
@@ -0,0 +1,456 @@
+/*
+ * bench/workload.c: Replay editing workloads without a window.
+ *
+ * Opens a file, or a generated C file of the given size in megabytes (64 by
+ * default), and times each step of a scripted session against the editor
+ * alone: opening the file, typing characters at random places, inserting and
+ * deleting lines at random places, highlighting the whole file, pasting 100 kB
+ * of text and saving it. Opening and highlighting are timed again with the
+ * file's lines and comment checkpoints in the line cache, which is kept in a
+ * temporary directory of its own. The steps are repeated a given number of
+ * times (2000 by default) where that makes sense, and their latency
+ * percentiles and throughput are printed as a JSON object, so runs can be
+ * compared over time. Anything else the editor prints goes to stderr.
+ * Positions come from a fixed seed, so every run does the same edits. Edits
+ * are journaled to a swap file next to the file, as they are in the editor.
+ *
+ *     bench/workload [megabytes] [operations] [file]
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../document.h"
+#include "../editor.h"
+#include "../file.h"
+#include "../highlight.h"
+#include "../journal.h"
+#include "../line.h"
+
+#define DEFAULT_MEGABYTES 64
+#define DEFAULT_OPERATIONS 2000
+#define DEFAULT_PATH "/tmp/glypher-workload-bench.c"
+#define CACHE_TEMPLATE "/tmp/glypher-workload-cache-XXXXXX"
+#define SAVE_SUFFIX ".bench-save"
+#define OPEN_RUNS 3
+#define SAVE_RUNS 3
+#define PASTE_BYTES 100000
+#define SEED 1
+#define ROWS 60
+#define COLS 200
+
+static const char *generated_source =
+	"#include <stdio.h>\n"
+	"\n"
+	"/*\n"
+	" * Count the words in a line of text, ignoring anything in quotes.\n"
+	" */\n"
+	"static int count_words(const char *text, unsigned long length)\n"
+	"{\n"
+	"\tint words = 0, in_word = 0;\n"
+	"\tfor (unsigned long i = 0; i < length; i++) {\n"
+	"\t\tif (text[i] == '\"' || text[i] == ' ') {\n"
+	"\t\t\tin_word = 0; // reset at separators\n"
+	"\t\t\tcontinue;\n"
+	"\t\t} else if (!in_word) {\n"
+	"\t\t\twords++;\n"
+	"\t\t\tin_word = 1;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\treturn words * 2 + 0x10 - 3.5;\n"
+	"}\n";
+
+static const char *inserted_line = "\tprintf(\"%d\\n\", count_words(line, 42)); /* inserted */";
+
+/* The times of each operation in a workload, in seconds. */
+struct samples {
+	double *times;
+	int count;
+	double total;
+	/* How much was done, in the unit the throughput is reported in. */
+	double amount;
+};
+
+static FILE *output;
+static int first_workload = 1;
+static char cache_home[] = CACHE_TEMPLATE;
+
+static pthread_mutex_t highlight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t highlight_ready = PTHREAD_COND_INITIALIZER;
+static int highlight_notified = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void samples_init(struct samples *samples, int capacity)
+{
+	samples->times = malloc(sizeof(double) * capacity);
+	samples->count = 0;
+	samples->total = 0;
+	samples->amount = 0;
+}
+
+static void samples_add(struct samples *samples, double seconds)
+{
+	samples->times[samples->count++] = seconds;
+	samples->total += seconds;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* A step that took no samples reports zeroes, so the JSON stays valid. */
+static double percentile(struct samples *samples, int percent)
+{
+	if (samples->count == 0)
+		return 0;
+
+	int index = (long)samples->count * percent / 100;
+	if (index >= samples->count)
+		index = samples->count - 1;
+	return samples->times[index] * 1e6;
+}
+
+/* Print a workload as a member of the JSON object and free its samples. */
+static void report(const char *name, struct samples *samples, const char *unit)
+{
+	qsort(samples->times, samples->count, sizeof(double), compare_times);
+	double throughput = samples->total > 0 ? samples->amount / samples->total : 0;
+	fprintf(output, "%s\n\t\"%s\": {\"count\": %d, \"seconds\": %.6f, \"%s\": %.1f, "
+			"\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+			first_workload ? "" : ",", name, samples->count, samples->total, unit, throughput,
+			percentile(samples, 50), percentile(samples, 90), percentile(samples, 99), percentile(samples, 100));
+	first_workload = 0;
+	free(samples->times);
+}
+
+/* Print a string as a JSON string, with quotes, backslashes and control characters escaped. */
+static void print_json_string(const char *string)
+{
+	fputc('"', output);
+	for (const unsigned char *c = (const unsigned char *)string; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(output, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(output, "\\u%04x", *c);
+		else
+			fputc(*c, output);
+	}
+	fputc('"', output);
+}
+
+static void generate_file(const char *path, size_t size)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	size_t length = strlen(generated_source);
+	for (size_t written = 0; written < size; written += length)
+		fwrite(generated_source, 1, length, file);
+	fclose(file);
+}
+
+static size_t file_size(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+/* Remove the files in the editor's cache directory, or the directory itself as well. */
+static void clear_cache(int remove_directory)
+{
+	char directory[PATH_MAX];
+	snprintf(directory, sizeof(directory), "%s/glypher", cache_home);
+
+	DIR *dir = opendir(directory);
+	if (dir != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] != '.')
+				unlinkat(dirfd(dir), entry->d_name, 0);
+		}
+		closedir(dir);
+	}
+
+	if (remove_directory) {
+		rmdir(directory);
+		rmdir(cache_home);
+	}
+}
+
+static void notify_highlight(void)
+{
+	pthread_mutex_lock(&highlight_lock);
+	highlight_notified = 1;
+	pthread_cond_signal(&highlight_ready);
+	pthread_mutex_unlock(&highlight_lock);
+}
+
+static void wait_for_highlight(void)
+{
+	pthread_mutex_lock(&highlight_lock);
+	while (!highlight_notified)
+		pthread_cond_wait(&highlight_ready, &highlight_lock);
+	highlight_notified = 0;
+	pthread_mutex_unlock(&highlight_lock);
+}
+
+/* Do what the window does for an event and a frame, except for drawing. */
+static void update_screen(struct editor_state *editor)
+{
+	editor_collect_highlight(editor);
+	editor_scroll(editor);
+	for (int i = editor->line_offset; i < editor->line_offset + editor->screen_rows && i < editor->num_lines; i++)
+		editor_render_line(editor, document_get(&editor->document, i));
+	editor_request_highlight(editor);
+	editor_clear_damage(editor);
+	editor_compact_journal(editor);
+}
+
+static void open_file(struct editor_state *editor, const char *path)
+{
+	init_editor(editor);
+	editor_set_screen_size(editor, ROWS, COLS);
+	editor_open(editor, (char *)path);
+}
+
+/*
+ * Open the file a few times. Closing it each time puts its lines in the line
+ * cache, which is emptied first unless the cached lines are to be used.
+ */
+static void bench_open(const char *name, struct editor_state *editor, const char *path, int cached)
+{
+	struct samples samples;
+	samples_init(&samples, OPEN_RUNS);
+	for (int run = 0; run < OPEN_RUNS; run++) {
+		if (run > 0 || cached)
+			editor_destroy(editor);
+		if (!cached)
+			clear_cache(0);
+
+		double start = now();
+		open_file(editor, path);
+		samples_add(&samples, now() - start);
+		samples.amount += file_size(path) / 1e6;
+	}
+	report(name, &samples, "mb_per_second");
+}
+
+/*
+ * Highlight every line, timing how long each batch of results takes to come
+ * back and be applied, or each batch of lines with cached checkpoints to be
+ * stepped over.
+ */
+static void bench_highlight(const char *name, struct editor_state *editor)
+{
+	struct samples samples;
+	samples_init(&samples, editor->num_lines + 1);
+
+	double start = now();
+	editor_request_highlight(editor);
+	while (editor->highlight_pending || editor->highlight_frontier < editor->num_lines) {
+		wait_for_highlight();
+		editor_collect_highlight(editor);
+		double end = now();
+		samples_add(&samples, end - start);
+		start = end;
+	}
+	samples.amount = editor->num_lines;
+	report(name, &samples, "lines_per_second");
+}
+
+static void move_to_random_place(struct editor_state *editor)
+{
+	if (editor->num_lines == 0) {
+		editor->cursor_y = 0;
+		editor->cursor_x = 0;
+		return;
+	}
+
+	editor->cursor_y = rand() % editor->num_lines;
+	editor->cursor_x = rand() % (document_get(&editor->document, editor->cursor_y)->size + 1);
+}
+
+static void bench_typing(struct editor_state *editor, int operations)
+{
+	struct samples samples;
+	samples_init(&samples, operations);
+	editor_set_mode(editor, EDITOR_MODE_INSERT);
+
+	for (int i = 0; i < operations; i++) {
+		move_to_random_place(editor);
+
+		double start = now();
+		editor_insert_char(editor, 'a' + i % 26);
+		update_screen(editor);
+		samples_add(&samples, now() - start);
+	}
+	editor_set_mode(editor, EDITOR_MODE_NORMAL);
+	samples.amount = operations;
+	report("type", &samples, "operations_per_second");
+}
+
+/* Insert a line and delete another, in turns. */
+static void bench_lines(struct editor_state *editor, int operations)
+{
+	struct samples samples;
+	samples_init(&samples, operations);
+
+	for (int i = 0; i < operations; i++) {
+		move_to_random_place(editor);
+
+		double start = now();
+		if (i % 2 == 0)
+			editor_insert_line(editor, editor->cursor_y, (char *)inserted_line, strlen(inserted_line));
+		else
+			editor_delete_line(editor, editor->cursor_y);
+		update_screen(editor);
+		samples_add(&samples, now() - start);
+	}
+	samples.amount = operations;
+	report("lines", &samples, "operations_per_second");
+}
+
+/*
+ * Paste text the way it arrives from an input method or a tool that types it:
+ * one text input event per character, and a Return key for each newline.
+ * Either every event is followed by a frame, or typed text is gathered up
+ * until the next key and a frame is drawn once the events run out, as the
+ * window does.
+ */
+static void bench_paste(const char *name, struct editor_state *editor, int coalesce)
+{
+	size_t source_length = strlen(generated_source);
+	char *text = malloc(PASTE_BYTES);
+	for (size_t i = 0; i < PASTE_BYTES; i++)
+		text[i] = generated_source[i % source_length];
+
+	move_to_random_place(editor);
+	editor_set_mode(editor, EDITOR_MODE_INSERT);
+
+	int redraws = 0;
+	size_t pending = 0;
+	double start = now();
+	clock_t start_cpu = clock();
+	for (size_t i = 0; i < PASTE_BYTES; i++) {
+		if (text[i] != '\n' && coalesce) {
+			pending++;
+			continue;
+		}
+
+		if (pending > 0) {
+			editor_insert_text(editor, &text[i - pending], pending);
+			pending = 0;
+		}
+		if (text[i] == '\n')
+			editor_insert_newline(editor);
+		else
+			editor_insert_char(editor, text[i]);
+
+		if (!coalesce) {
+			update_screen(editor);
+			redraws++;
+		}
+	}
+	if (pending > 0)
+		editor_insert_text(editor, &text[PASTE_BYTES - pending], pending);
+	if (coalesce) {
+		update_screen(editor);
+		redraws++;
+	}
+	double cpu_seconds = (double)(clock() - start_cpu) / CLOCKS_PER_SEC;
+
+	editor_set_mode(editor, EDITOR_MODE_NORMAL);
+	fprintf(output, ",\n\t\"%s\": {\"events\": %d, \"redraws\": %d, \"seconds\": %.6f, \"cpu_seconds\": %.6f}",
+			name, PASTE_BYTES, redraws, now() - start, cpu_seconds);
+	free(text);
+}
+
+static void bench_save(struct editor_state *editor, const char *path)
+{
+	size_t length = strlen(path) + sizeof(SAVE_SUFFIX);
+	free(editor->filename);
+	editor->filename = malloc(length);
+	snprintf(editor->filename, length, "%s%s", path, SAVE_SUFFIX);
+
+	struct samples samples;
+	samples_init(&samples, SAVE_RUNS);
+	for (int run = 0; run < SAVE_RUNS; run++) {
+		double start = now();
+		int error = file_save_current_file(editor);
+		samples_add(&samples, now() - start);
+
+		if (error != 0) {
+			fprintf(stderr, "Saving failed: %s\n", strerror(error));
+			exit(1);
+		}
+		samples.amount += file_size(editor->filename) / 1e6;
+	}
+	unlink(editor->filename);
+	report("save", &samples, "mb_per_second");
+}
+
+int main(int argc, char **argv)
+{
+	double megabytes = argc >= 2 ? atof(argv[1]) : DEFAULT_MEGABYTES;
+	int operations = argc >= 3 ? atoi(argv[2]) : DEFAULT_OPERATIONS;
+	const char *path = argc >= 4 ? argv[3] : DEFAULT_PATH;
+
+	/* Keep stdout for the results, and send what the editor prints to stderr. */
+	output = fdopen(dup(STDOUT_FILENO), "w");
+	fflush(stdout);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	if (argc < 4)
+		generate_file(path, megabytes * 1e6);
+	if (mkdtemp(cache_home) == NULL) {
+		perror(cache_home);
+		return 1;
+	}
+	setenv("XDG_CACHE_HOME", cache_home, 1);
+	srand(SEED);
+	highlight_start(notify_highlight);
+	journal_start();
+
+	struct editor_state editor;
+	fprintf(output, "{");
+	bench_open("open", &editor, path, 0);
+	int num_lines = editor.num_lines;
+	bench_highlight("highlight", &editor);
+	bench_open("open_cached", &editor, path, 1);
+	bench_highlight("highlight_cached", &editor);
+	bench_typing(&editor, operations);
+	bench_lines(&editor, operations);
+	bench_paste("paste_per_event", &editor, 0);
+	bench_paste("paste_coalesced", &editor, 1);
+	bench_save(&editor, path);
+	fprintf(output, ",\n\t\"file\": {\"path\": ");
+	print_json_string(path);
+	fprintf(output, ", \"bytes\": %zu, \"lines\": %d}\n}\n", file_size(path), num_lines);
+	fclose(output);
+
+	highlight_stop();
+	editor_destroy(&editor);
+	journal_stop();
+	clear_cache(1);
+	if (argc < 4)
+		unlink(path);
+	return 0;
+}
@@ -0,0 +1,271 @@
+#include "buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "editor.h"
+#include "error.h"
+#include "file.h"
+#include "highlight.h"
+#include "journal.h"
+#include "linecache.h"
+#include "preload.h"
+
+/* Set the editor up to edit a new, empty file. */
+void editor_init_buffer(struct editor_state *editor)
+{
+	editor->cursor_x = 0;
+	editor->cursor_y = 0;
+	editor->cursor_display_x = 0;
+	editor->line_offset = 0;
+	editor->col_offset = 0;
+	editor->num_lines = 0;
+	document_init(&editor->document);
+	editor->dirty = 0;
+	editor->filename = NULL;
+	editor->syntax = NULL;
+	editor->highlight_frontier = 0;
+	editor->highlight_pending = 0;
+	search_init(&editor->search);
+	undo_init(&editor->undo);
+	editor->journal = NULL;
+	editor_damage_all(editor);
+}
+
+static void store_buffer(struct editor_state *editor, struct editor_buffer *buffer)
+{
+	buffer->cursor_x = editor->cursor_x;
+	buffer->cursor_y = editor->cursor_y;
+	buffer->line_offset = editor->line_offset;
+	buffer->col_offset = editor->col_offset;
+	buffer->num_lines = editor->num_lines;
+	buffer->document = editor->document;
+	buffer->dirty = editor->dirty;
+	buffer->filename = editor->filename;
+	buffer->syntax = editor->syntax;
+	buffer->highlight_frontier = editor->highlight_frontier;
+	buffer->search = editor->search;
+	buffer->undo = editor->undo;
+	buffer->journal = editor->journal;
+	buffer->loaded = 1;
+}
+
+static void load_buffer(struct editor_state *editor, struct editor_buffer *buffer)
+{
+	editor->cursor_x = buffer->cursor_x;
+	editor->cursor_y = buffer->cursor_y;
+	editor->line_offset = buffer->line_offset;
+	editor->col_offset = buffer->col_offset;
+	editor->num_lines = buffer->num_lines;
+	editor->document = buffer->document;
+	editor->dirty = buffer->dirty;
+	editor->filename = buffer->filename;
+	editor->syntax = buffer->syntax;
+	editor->highlight_frontier = buffer->highlight_frontier;
+	editor->highlight_pending = 0;
+	editor->search = buffer->search;
+	editor->undo = buffer->undo;
+	editor->journal = buffer->journal;
+	editor_damage_all(editor);
+
+	if (!buffer->loaded) {
+		char *filename = editor->filename;
+		editor->filename = NULL;
+		editor_open(editor, filename);
+		free(filename);
+	}
+}
+
+static void free_buffer(struct editor_buffer *buffer)
+{
+	linecache_store(&buffer->document, buffer->filename, buffer->syntax, buffer->highlight_frontier);
+	journal_close(buffer->journal);
+	free(buffer->filename);
+	document_free(&buffer->document);
+	search_free(&buffer->search);
+	undo_free(&buffer->undo);
+}
+
+/* Put the current file away in its place in the list, to edit another. */
+static void leave_buffer(struct editor_state *editor)
+{
+	/* Highlighting results are for the lines of the file they were asked for from. */
+	editor_cancel_highlight(editor);
+	store_buffer(editor, &editor->buffers[editor->current_buffer]);
+}
+
+/* Start loading the buffers either side of the current one, which are the likeliest to be switched to next. */
+static void preload_neighbours(struct editor_state *editor)
+{
+	for (int direction = -1; direction <= 1; direction += 2) {
+		int index = (editor->current_buffer + direction + editor->num_buffers) % editor->num_buffers;
+		if (index != editor->current_buffer && !editor->buffers[index].loaded)
+			preload_file(editor->buffers[index].filename);
+	}
+}
+
+static void show_buffer(struct editor_state *editor)
+{
+	editor_set_status_message(editor, "[%d/%d] %s", editor->current_buffer + 1, editor->num_buffers,
+			editor->filename ? editor->filename : "[New File]");
+	preload_neighbours(editor);
+}
+
+void editor_switch_buffer(struct editor_state *editor, int index)
+{
+	if (index == editor->current_buffer)
+		return;
+
+	leave_buffer(editor);
+	load_buffer(editor, &editor->buffers[index]);
+	editor->current_buffer = index;
+	show_buffer(editor);
+}
+
+/* Switch to the next or previous buffer, wrapping around the list. */
+void editor_next_buffer(struct editor_state *editor, int direction)
+{
+	if (editor->num_buffers == 1) {
+		editor_set_status_message(editor, "There are no other buffers");
+		return;
+	}
+
+	int index = (editor->current_buffer + direction + editor->num_buffers) % editor->num_buffers;
+	editor_switch_buffer(editor, index);
+}
+
+static int find_buffer(struct editor_state *editor, const char *filename)
+{
+	if (editor->filename != NULL && strcmp(editor->filename, filename) == 0)
+		return editor->current_buffer;
+
+	for (int i = 0; i < editor->num_buffers; i++) {
+		if (i != editor->current_buffer && editor->buffers[i].filename != NULL
+				&& strcmp(editor->buffers[i].filename, filename) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static void grow_buffers(struct editor_state *editor, const char *filename)
+{
+	editor->buffers = realloc(editor->buffers, sizeof(struct editor_buffer) * (editor->num_buffers + 1));
+	if (editor->buffers == NULL)
+		fatal_error("Failed to allocate a buffer for %s\n", filename);
+}
+
+/* Edit a file in a buffer of its own, or switch to the buffer it is already open in. */
+void editor_edit_file(struct editor_state *editor, char *filename)
+{
+	int index = find_buffer(editor, filename);
+	if (index >= 0) {
+		editor_switch_buffer(editor, index);
+		return;
+	}
+
+	/* A new file that nothing has been typed into is replaced, rather than kept in a buffer of its own. */
+	if (editor->filename == NULL && !editor->dirty && editor->num_lines == 0) {
+		editor_open(editor, filename);
+		show_buffer(editor);
+		return;
+	}
+
+	grow_buffers(editor, filename);
+	leave_buffer(editor);
+	editor->current_buffer = editor->num_buffers++;
+	editor_init_buffer(editor);
+	editor_open(editor, filename);
+	show_buffer(editor);
+}
+
+/* Add a file to the end of the buffer list, to be loaded in the background until it is switched to. */
+void editor_add_file(struct editor_state *editor, char *filename)
+{
+	if (find_buffer(editor, filename) >= 0) {
+		editor_set_status_message(editor, "%s is already open", filename);
+		return;
+	}
+
+	grow_buffers(editor, filename);
+	struct editor_buffer *buffer = &editor->buffers[editor->num_buffers++];
+	buffer->cursor_x = buffer->cursor_y = 0;
+	buffer->line_offset = buffer->col_offset = 0;
+	buffer->num_lines = 0;
+	document_init(&buffer->document);
+	buffer->dirty = 0;
+	buffer->filename = strdup(filename);
+	buffer->syntax = NULL;
+	buffer->highlight_frontier = 0;
+	search_init(&buffer->search);
+	undo_init(&buffer->undo);
+	buffer->journal = NULL;
+	buffer->loaded = 0;
+
+	preload_file(filename);
+}
+
+/*
+ * Close the current buffer and switch to the one after it. A file without
+ * changes is given to the preload cache, so opening it again is instant.
+ */
+void editor_close_buffer(struct editor_state *editor)
+{
+	if (editor->dirty) {
+		editor_set_status_message(editor, "This file has unsaved changes. Save it first");
+		return;
+	}
+
+	editor_cancel_highlight(editor);
+	linecache_store(&editor->document, editor->filename, editor->syntax, editor->highlight_frontier);
+	journal_close(editor->journal);
+	if (editor->filename != NULL)
+		preload_keep(editor->filename, &editor->document);
+	else
+		document_free(&editor->document);
+	free(editor->filename);
+	search_free(&editor->search);
+	undo_free(&editor->undo);
+
+	int index = editor->current_buffer;
+	editor->num_buffers--;
+	memmove(&editor->buffers[index], &editor->buffers[index + 1], sizeof(struct editor_buffer) * (editor->num_buffers - index));
+
+	/* Closing the last buffer leaves a new file to edit. */
+	if (editor->num_buffers == 0) {
+		editor->num_buffers = 1;
+		editor->current_buffer = 0;
+		editor_init_buffer(editor);
+		return;
+	}
+
+	if (index == editor->num_buffers)
+		index = 0;
+	editor->current_buffer = index;
+	load_buffer(editor, &editor->buffers[index]);
+	show_buffer(editor);
+}
+
+int editor_any_buffer_dirty(struct editor_state *editor)
+{
+	if (editor->dirty)
+		return 1;
+
+	for (int i = 0; i < editor->num_buffers; i++) {
+		if (i != editor->current_buffer && editor->buffers[i].dirty)
+			return 1;
+	}
+	return 0;
+}
+
+/* Free every buffer but the current one, which the editor frees itself. */
+void editor_free_buffers(struct editor_state *editor)
+{
+	for (int i = 0; i < editor->num_buffers; i++) {
+		if (i != editor->current_buffer)
+			free_buffer(&editor->buffers[i]);
+	}
+	free(editor->buffers);
+	editor->buffers = NULL;
+	editor->num_buffers = 0;
+	editor->current_buffer = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * buffer.h: Editing several files at once.
+ *
+ * The editor works on one file at a time, which it keeps in its own fields.
+ * The other open files wait in its buffer list, and switching to one swaps
+ * its state with the current file's. Everything that is not about a single
+ * file, such as the window, the font and the syntax rules, is shared by all
+ * of them. A file can be added to the list before it is loaded, in which
+ * case it is loaded in the background and opened when it is switched to.
+ */
+
+#ifndef _BUFFER_LIST_H
+#define _BUFFER_LIST_H
+
+#include "document.h"
+#include "search.h"
+#include "undo.h"
+
+struct editor_state;
+struct editor_syntax;
+struct journal;
+
+/* The state of a file that is open, but not the one being edited. */
+struct editor_buffer {
+	int cursor_x, cursor_y;
+	int line_offset;
+	int col_offset;
+	int num_lines;
+	struct document document;
+	int dirty;
+	char *filename;
+	struct editor_syntax *syntax;
+	int highlight_frontier;
+	struct search search;
+	struct undo_log undo;
+	struct journal *journal;
+	/* Whether the file has been opened, rather than only added to the list. */
+	int loaded;
+};
+
+void editor_init_buffer(struct editor_state *);
+void editor_switch_buffer(struct editor_state *, int index);
+void editor_next_buffer(struct editor_state *, int direction);
+void editor_edit_file(struct editor_state *, char *filename);
+void editor_add_file(struct editor_state *, char *filename);
+void editor_close_buffer(struct editor_state *);
+int editor_any_buffer_dirty(struct editor_state *);
+void editor_free_buffers(struct editor_state *);
+
+#endif
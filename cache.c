@@ -0,0 +1,122 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_DIRECTORY "glypher"
+
+/* FNV-1a, to turn a key of any length into a file name. */
+static uint64_t hash_key(const char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (const unsigned char *c = (const unsigned char *)key; *c; c++) {
+		hash ^= *c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int make_directory(const char *path)
+{
+	return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+/*
+ * Find the file that caches one kind of data for the given key, creating the
+ * cache directory if needed. Returns NULL if there is nowhere to cache it.
+ */
+char *cache_path(const char *kind, const char *key)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *suffix = "";
+
+	/* Relative paths are to be ignored, as the specification says. */
+	if (base == NULL || base[0] != '/') {
+		base = getenv("HOME");
+		suffix = "/.cache";
+		if (base == NULL || base[0] != '/')
+			return NULL;
+	}
+
+	size_t size = strlen(base) + strlen(suffix) + strlen(CACHE_DIRECTORY) + strlen(kind) + 24;
+	char *path = malloc(size);
+
+	snprintf(path, size, "%s%s", base, suffix);
+	if (!make_directory(path))
+		goto fail;
+
+	snprintf(path, size, "%s%s/%s", base, suffix, CACHE_DIRECTORY);
+	if (!make_directory(path))
+		goto fail;
+
+	snprintf(path, size, "%s%s/%s/%s-%016llx", base, suffix, CACHE_DIRECTORY, kind, (unsigned long long)hash_key(key));
+	return path;
+
+fail:
+	free(path);
+	return NULL;
+}
+
+/* Map a whole cache file into memory. Returns NULL if it can not be read. */
+void *cache_map(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat file_stat;
+	void *data = NULL;
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+		data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+		*size = file_stat.st_size;
+	}
+
+	close(fd);
+	return data;
+}
+
+void cache_unmap(void *data, size_t size)
+{
+	munmap(data, size);
+}
+
+/*
+ * Replace a cache file with the given parts. They are written to a temporary
+ * file first, so that another editor never maps a half-written one.
+ */
+int cache_store(const char *path, const struct iovec *parts, int num_parts)
+{
+	size_t temp_size = strlen(path) + 16;
+	char *temp_path = malloc(temp_size);
+	snprintf(temp_path, temp_size, "%s.%ld", path, (long)getpid());
+
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		free(temp_path);
+		return 0;
+	}
+
+	size_t total = 0;
+	for (int i = 0; i < num_parts; i++)
+		total += parts[i].iov_len;
+
+	int stored = writev(fd, parts, num_parts) == (ssize_t)total;
+	if (close(fd) != 0)
+		stored = 0;
+	if (stored)
+		stored = rename(temp_path, path) == 0;
+	if (!stored)
+		unlink(temp_path);
+
+	free(temp_path);
+	return stored;
+}
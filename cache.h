@@ -0,0 +1,20 @@
+/*
+ * cache.h: Files kept between runs to save work when starting up.
+ *
+ * Cache files live in $XDG_CACHE_HOME/glypher, or ~/.cache/glypher. They are
+ * only ever a copy of something that can be worked out again, so any of the
+ * functions here may fail, and callers carry on without the cache.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+char *cache_path(const char *kind, const char *key);
+void *cache_map(const char *path, size_t *size);
+void cache_unmap(void *data, size_t size);
+int cache_store(const char *path, const struct iovec *parts, int num_parts);
+
+#endif
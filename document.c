@@ -0,0 +1,138 @@
+#include "document.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "error.h"
+
+#define DOCUMENT_MIN_CAPACITY 16
+
+void document_init(struct document *document)
+{
+	document->lines = NULL;
+	document->capacity = 0;
+	document->gap_start = 0;
+	document->gap_end = 0;
+	document->generation = 0;
+	document->mapping = NULL;
+	document->mapping_size = 0;
+	document->mapping_fd = -1;
+	memset(&document->mapping_key, 0, sizeof(document->mapping_key));
+	document->mapping_generation = 0;
+	document->cached_checkpoints = -1;
+	pool_init(&document->pool);
+}
+
+int document_num_lines(struct document *document)
+{
+	return document->capacity - (document->gap_end - document->gap_start);
+}
+
+line_t *document_get(struct document *document, int at)
+{
+	if (at >= document->gap_start)
+		at += document->gap_end - document->gap_start;
+	return &document->lines[at];
+}
+
+int document_index_of(struct document *document, line_t *line)
+{
+	int slot = line - document->lines;
+	if (slot >= document->gap_end)
+		slot -= document->gap_end - document->gap_start;
+	return slot;
+}
+
+/* Move the gap so that it starts at the given line. */
+static void document_move_gap(struct document *document, int at)
+{
+	int gap_size = document->gap_end - document->gap_start;
+
+	if (at < document->gap_start) {
+		int count = document->gap_start - at;
+		memmove(&document->lines[at + gap_size], &document->lines[at], sizeof(line_t) * count);
+	} else if (at > document->gap_start) {
+		int count = at - document->gap_start;
+		memmove(&document->lines[document->gap_start], &document->lines[document->gap_end], sizeof(line_t) * count);
+	}
+
+	document->gap_start = at;
+	document->gap_end = at + gap_size;
+}
+
+/* Change the capacity of the document, keeping the new space in the gap. */
+static void document_resize(struct document *document, int new_capacity)
+{
+	line_t *new_lines = realloc(document->lines, sizeof(line_t) * new_capacity);
+	if (new_lines == NULL)
+		fatal_error("Failed to grow document to %d lines\n", new_capacity);
+
+	int tail = document->capacity - document->gap_end;
+	memmove(&new_lines[new_capacity - tail], &new_lines[document->gap_end], sizeof(line_t) * tail);
+
+	document->lines = new_lines;
+	document->gap_end = new_capacity - tail;
+	document->capacity = new_capacity;
+}
+
+/* Double the capacity of the document. */
+static void document_grow(struct document *document)
+{
+	int new_capacity = document->capacity * 2;
+	if (new_capacity < DOCUMENT_MIN_CAPACITY)
+		new_capacity = DOCUMENT_MIN_CAPACITY;
+
+	document_resize(document, new_capacity);
+}
+
+line_t *document_insert(struct document *document, int at)
+{
+	if (document->gap_start == document->gap_end)
+		document_grow(document);
+
+	document_move_gap(document, at);
+	document->generation++;
+	return &document->lines[document->gap_start++];
+}
+
+line_t *document_append(struct document *document, int count)
+{
+	int num_lines = document_num_lines(document);
+
+	document_move_gap(document, num_lines);
+	if (document->gap_end - document->gap_start < count)
+		document_resize(document, num_lines + count);
+
+	document->generation++;
+	line_t *lines = &document->lines[document->gap_start];
+	document->gap_start += count;
+	return lines;
+}
+
+void document_remove(struct document *document, int at)
+{
+	document_move_gap(document, at);
+	document->generation++;
+	document->gap_end++;
+}
+
+void document_unmap(struct document *document)
+{
+	if (document->mapping != NULL)
+		munmap(document->mapping, document->mapping_size);
+	if (document->mapping_fd != -1)
+		close(document->mapping_fd);
+	document->mapping = NULL;
+	document->mapping_size = 0;
+	document->mapping_fd = -1;
+}
+
+void document_free(struct document *document)
+{
+	document_unmap(document);
+	pool_free(&document->pool);
+	free(document->lines);
+	document_init(document);
+}
@@ -0,0 +1,69 @@
+/*
+ * document.h: Line storage for an editor buffer.
+ *
+ * The lines of a document are kept in a gap buffer. Inserting or deleting a
+ * line only moves the lines between the previous edit and this one, so edits
+ * made around the cursor take constant time no matter how long the file is.
+ */
+
+#ifndef _DOCUMENT_H
+#define _DOCUMENT_H
+
+#include "line.h"
+#include "linecache.h"
+#include "pool.h"
+
+struct document {
+	line_t *lines;
+	int capacity;
+	/* The unused slots in `lines` are the ones from gap_start to gap_end. */
+	int gap_start;
+	int gap_end;
+	/* Changes whenever lines are inserted or removed. */
+	unsigned int generation;
+	/*
+	 * The file that mapped lines point into, if it was opened that way. The
+	 * file stays open to copy unchanged text straight from it when saving.
+	 */
+	char *mapping;
+	size_t mapping_size;
+	int mapping_fd;
+	/*
+	 * The mapped file as it was when it was opened, and the generation its
+	 * lines were loaded at, for keeping them in the line cache. The cache holds
+	 * this many lines' comment checkpoints, or -1 if it has not been used.
+	 */
+	struct linecache_key mapping_key;
+	unsigned int mapping_generation;
+	int cached_checkpoints;
+	/* Where the lines' own text and render data are allocated. */
+	struct pool pool;
+};
+
+void document_init(struct document *);
+
+int document_num_lines(struct document *);
+line_t *document_get(struct document *, int at);
+int document_index_of(struct document *, line_t *);
+
+/*
+ * Make room for a new line at the given position and return it. The line is
+ * left uninitialised, and any previously returned pointers become invalid.
+ */
+line_t *document_insert(struct document *, int at);
+
+/*
+ * Add a number of lines to the end of the document with at most one
+ * allocation, and return the first of them. They are left uninitialised too.
+ */
+line_t *document_append(struct document *, int count);
+
+/* Remove a line from the document. The caller is responsible for freeing it with free_line. */
+void document_remove(struct document *, int at);
+
+/* Release the file mapping. Any lines pointing into it must be copied first. */
+void document_unmap(struct document *);
+
+void document_free(struct document *);
+
+#endif
@@ -1,16 +1,20 @@
 #include "editor.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "error.h"
 #include "file.h"
-#include "input.h"
+#include "highlight.h"
+#include "journal.h"
+#include "linecache.h"
+#include "search.h"
 #include "syntax.h"
-#include "window.h"
 
 /* How long a message stays on screen */
 #define MESSAGE_TIMEOUT_SECONDS 5
@@ -22,23 +26,20 @@ static int quit_message_time = 0;
 
 void init_editor(struct editor_state* editor)
 {
-	editor->cursor_x = 0;
-	editor->cursor_y = 0;
-	editor->cursor_display_x = 0;
-	editor->line_offset = 0;
-	editor->col_offset = 0;
-	editor->num_lines = 0;
-	editor->lines = NULL;
-	editor->dirty = 0;
-	editor->filename = NULL;
+	editor_init_buffer(editor);
+	editor->buffers = malloc(sizeof(struct editor_buffer));
+	if (editor->buffers == NULL)
+		fatal_error("Failed to allocate the buffer list\n");
+	editor->num_buffers = 1;
+	editor->current_buffer = 0;
+
 	editor->status_message[0] = '\0';
 	editor->status_message_time = 0;
-	editor->syntax = NULL;
 	editor->mode = EDITOR_MODE_NORMAL;
 	editor->cmdline = textbuf_init();
-
-	editor_update_screen_size(editor);
-	window_set_filename("[New]");
+	editor->screen_rows = 0;
+	editor->screen_cols = 0;
+	editor->quit = 0;
 }
 
 void editor_set_status_message(struct editor_state* editor, const char* format, ...)
@@ -51,25 +52,164 @@ void editor_set_status_message(struct editor_state* editor, const char* format,
 }
 
 static prompt_callback_t saved_prompt_callback;
+static prompt_callback_t saved_update_callback;
 
 void editor_prompt(struct editor_state* editor, char* prompt, prompt_callback_t callback)
 {
 	saved_prompt_callback = callback;
+	saved_update_callback = NULL;
 	editor_set_mode(editor, EDITOR_MODE_PROMPT);
 }
 
+/*
+ * Like editor_prompt, but also pass the text to the update callback every time
+ * it changes, and NULL if the prompt is cancelled.
+ */
+void editor_prompt_incremental(struct editor_state *editor, char *prompt, prompt_callback_t callback, prompt_callback_t update)
+{
+	editor_prompt(editor, prompt, callback);
+	saved_update_callback = update;
+}
+
+void editor_prompt_changed(struct editor_state *editor)
+{
+	if (saved_update_callback)
+		saved_update_callback(editor, editor->cmdline.buffer, editor->cmdline.length);
+}
+
+void editor_cancel_prompt(struct editor_state *editor)
+{
+	if (saved_update_callback)
+		saved_update_callback(editor, NULL, 0);
+	editor_set_mode(editor, EDITOR_MODE_NORMAL);
+}
+
 void editor_run_command(struct editor_state *editor)
 {
 	textbuf_append(&editor->cmdline, "\0", 1);
 
-	if (saved_prompt_callback) {
+	if (saved_prompt_callback)
 		saved_prompt_callback(editor, editor->cmdline.buffer, editor->cmdline.length);
-	}
+	else
+		editor_execute_command(editor, editor->cmdline.buffer);
 
-	/* TODO: Parse and run a command by its name */
 	editor_set_mode(editor, EDITOR_MODE_NORMAL);
 }
 
+/*
+ * Cut a part of a substitute command off at an unescaped delimiter, and remove
+ * the escapes from any delimiters in it. Returns the rest of the command, or
+ * NULL if there was no delimiter.
+ */
+static char *split_substitute(char *part, char delimiter)
+{
+	char *out = part;
+	for (char *p = part; *p != '\0'; p++) {
+		if (*p == '\\' && p[1] == delimiter) {
+			*out++ = *++p;
+		} else if (*p == delimiter) {
+			*out = '\0';
+			return p + 1;
+		} else {
+			*out++ = *p;
+		}
+	}
+	*out = '\0';
+	return NULL;
+}
+
+/* Add the replacement for a match to a line, where & stands for the matched text. */
+static void append_replacement(struct textbuf *text, const char *replacement, const char *match, int match_length)
+{
+	for (const char *p = replacement; *p != '\0'; p++) {
+		if (*p == '&')
+			textbuf_append(text, match, match_length);
+		else if (*p == '\\' && (p[1] == '&' || p[1] == '\\'))
+			textbuf_append(text, ++p, 1);
+		else
+			textbuf_append(text, p, 1);
+	}
+}
+
+/*
+ * Replace every match of a regular expression in the document, as in
+ * s/pattern/replacement/. The matches come from the search, so a pattern that
+ * was just searched for is not run again.
+ */
+static void editor_substitute(struct editor_state *editor, char *command)
+{
+	char delimiter = command[0];
+	if (delimiter == '\0') {
+		editor_set_status_message(editor, "Usage: s/pattern/replacement/");
+		return;
+	}
+
+	char *pattern = command + 1;
+	char *replacement = split_substitute(pattern, delimiter);
+	if (replacement == NULL)
+		replacement = "";
+	else
+		split_substitute(replacement, delimiter);
+
+	if (editor_search_regex(editor, pattern, strlen(pattern)) != 0)
+		return;
+
+	/* Take the matches out of the search, so that replacing lines does not search them again. */
+	int num_matches = editor->search.num_matches;
+	struct search_match *matches = malloc(sizeof(struct search_match) * (num_matches + 1));
+	memcpy(matches, editor->search.matches, sizeof(struct search_match) * num_matches);
+	editor_search_clear(editor);
+
+	int num_lines = 0;
+	struct textbuf text = textbuf_init();
+	for (int i = 0; i < num_matches; num_lines++) {
+		line_t *line = document_get(&editor->document, matches[i].line);
+		int x = 0;
+
+		textbuf_clear(&text);
+		for (int at = matches[i].line; i < num_matches && matches[i].line == at; i++) {
+			textbuf_append(&text, &line->chars[x], matches[i].x - x);
+			append_replacement(&text, replacement, &line->chars[matches[i].x], matches[i].length);
+			x = matches[i].x + matches[i].length;
+		}
+		textbuf_append(&text, &line->chars[x], line->size - x);
+
+		line_set_string(editor, line, text.buffer, text.length);
+	}
+	textbuf_free(&text);
+	free(matches);
+
+	if (num_matches == 0)
+		editor_set_status_message(editor, "No matches for '%s'", pattern);
+	else
+		editor_set_status_message(editor, "Replaced %d matches on %d lines", num_matches, num_lines);
+}
+
+/* Run a command typed after ':'. */
+void editor_execute_command(struct editor_state *editor, char *command)
+{
+	if (command[0] == 's' && ispunct((unsigned char)command[1]))
+		editor_substitute(editor, command + 1);
+	else if (command[0] == 'e' && (command[1] == ' ' || command[1] == '\0')) {
+		char *filename = command + 1;
+		while (*filename == ' ')
+			filename++;
+		if (*filename == '\0')
+			editor_set_status_message(editor, "No file name");
+		else
+			editor_edit_file(editor, filename);
+	} else if (strncmp(command, "badd ", 5) == 0)
+		editor_add_file(editor, command + 5);
+	else if (strcmp(command, "bd") == 0)
+		editor_close_buffer(editor);
+	else if (strcmp(command, "bn") == 0)
+		editor_next_buffer(editor, 1);
+	else if (strcmp(command, "bp") == 0)
+		editor_next_buffer(editor, -1);
+	else if (command[0] != '\0')
+		editor_set_status_message(editor, "Unknown command: %s", command);
+}
+
 static void save_callback(struct editor_state *editor, char *filename, size_t namelen)
 {
 	if (filename == NULL)
@@ -79,7 +219,6 @@ static void save_callback(struct editor_state *editor, char *filename, size_t na
 	memcpy(editor->filename, filename, namelen);
 
 	editor_select_syntax_highlight(editor);
-	window_set_filename(editor->filename);
 
 	editor_try_save(editor);
 }
@@ -102,12 +241,13 @@ void editor_try_save(struct editor_state *editor)
 
 void editor_try_quit(struct editor_state *editor)
 {
-	if (editor->dirty && quit_message_time == 0) {
-		editor_set_status_message(editor, "This file has unsaved changes. Press Ctrl+Q again to quit");
+	if (editor_any_buffer_dirty(editor) && quit_message_time == 0) {
+		editor_set_status_message(editor, "%s unsaved changes. Press Ctrl+Q again to quit",
+				editor->dirty ? "This file has" : "Another buffer has");
 		quit_message_time = time(NULL);
 		return;
 	}
-	exit(0);
+	editor->quit = 1;
 }
 
 void editor_move_left(struct editor_state *editor)
@@ -116,13 +256,13 @@ void editor_move_left(struct editor_state *editor)
 		editor->cursor_x--;
 	} else if (editor->cursor_y > 0) {
 		editor->cursor_y--;
-		editor->cursor_x = editor->lines[editor->cursor_y].size;
+		editor->cursor_x = document_get(&editor->document, editor->cursor_y)->size;
 	}
 }
 
 void editor_move_right(struct editor_state *editor)
 {
-	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : &editor->lines[editor->cursor_y];
+	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : document_get(&editor->document, editor->cursor_y);
 	if (line && editor->cursor_x < line->size) {
 		editor->cursor_x++;
 	} else if (line && editor->cursor_x == line->size) {
@@ -136,7 +276,7 @@ void editor_move_up(struct editor_state *editor)
 	if (editor->cursor_y != 0)
 		editor->cursor_y--;
 
-	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : &editor->lines[editor->cursor_y];
+	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : document_get(&editor->document, editor->cursor_y);
 	int line_length = line ? line->size : 0;
 	if (editor->cursor_x > line_length)
 		editor->cursor_x = line_length;
@@ -147,7 +287,7 @@ void editor_move_down(struct editor_state *editor)
 	if (editor->cursor_y != editor->num_lines - 1)
 		editor->cursor_y++;
 
-	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : &editor->lines[editor->cursor_y];
+	line_t *line = (editor->cursor_y >= editor->num_lines) ? NULL : document_get(&editor->document, editor->cursor_y);
 	int line_length = line ? line->size : 0;
 	if (editor->cursor_x > line_length)
 		editor->cursor_x = line_length;
@@ -156,7 +296,7 @@ void editor_move_down(struct editor_state *editor)
 void editor_move_end(struct editor_state *editor)
 {
 	if (editor->cursor_y < editor->num_lines)
-		editor->cursor_x = editor->lines[editor->cursor_y].size;
+		editor->cursor_x = document_get(&editor->document, editor->cursor_y)->size;
 }
 
 void editor_insert_char(struct editor_state* editor, int c)
@@ -164,21 +304,29 @@ void editor_insert_char(struct editor_state* editor, int c)
 	if (editor->cursor_y == editor->num_lines)
 		editor_insert_line(editor, editor->num_lines, "", 0);
 
-	line_insert_char(editor, &editor->lines[editor->cursor_y], editor->cursor_x, c);
+	line_insert_char(editor, document_get(&editor->document, editor->cursor_y), editor->cursor_x, c);
 	editor->cursor_x++;
 }
 
+/* Insert text at the cursor with a single change to the line, rather than a character at a time. */
+void editor_insert_text(struct editor_state *editor, const char *text, size_t length)
+{
+	if (editor->cursor_y == editor->num_lines)
+		editor_insert_line(editor, editor->num_lines, "", 0);
+
+	line_insert_string(editor, document_get(&editor->document, editor->cursor_y), editor->cursor_x, text, length);
+	editor->cursor_x += length;
+}
+
 void editor_insert_newline(struct editor_state* editor)
 {
 	if (editor->cursor_x == 0) {
 		editor_insert_line(editor, editor->cursor_y, "", 0);
 	} else {
-		line_t *line = &editor->lines[editor->cursor_y];
+		line_t *line = document_get(&editor->document, editor->cursor_y);
 		editor_insert_line(editor, editor->cursor_y + 1, &line->chars[editor->cursor_x], line->size - editor->cursor_x);
-		line = &editor->lines[editor->cursor_y];
-		line->size = editor->cursor_x;
-		line->chars[line->size] = '\0';
-		editor_update_line(editor, line);
+		line = document_get(&editor->document, editor->cursor_y);
+		line_truncate(editor, line, editor->cursor_x);
 	}
 	editor->cursor_y++;
 	editor->cursor_x = 0;
@@ -192,13 +340,14 @@ void editor_delete_char(struct editor_state* editor)
 	if (editor->cursor_x == 0 && editor->cursor_y == 0)
 		return;
 
-	line_t *line = &editor->lines[editor->cursor_y];
+	line_t *line = document_get(&editor->document, editor->cursor_y);
 	if (editor->cursor_x > 0) {
 		line_delete_char(editor, line, editor->cursor_x - 1);
 		editor->cursor_x--;
 	} else {
-		editor->cursor_x = editor->lines[editor->cursor_y - 1].size;
-		line_append_string(editor, &editor->lines[editor->cursor_y - 1], line->chars, line->size);
+		line_t *previous = document_get(&editor->document, editor->cursor_y - 1);
+		editor->cursor_x = previous->size;
+		line_append_string(editor, previous, line->chars, line->size);
 		editor_delete_line(editor, editor->cursor_y);
 		editor->cursor_y--;
 	}
@@ -227,6 +376,7 @@ void editor_set_mode(struct editor_state *editor, enum editor_mode mode)
 	if (last_mode == EDITOR_MODE_PROMPT) {
 		textbuf_clear(&editor->cmdline);
 		saved_prompt_callback = NULL;
+		saved_update_callback = NULL;
 	}
 
 	/* Ignore the extra first letter if we are entering a typing mode. */
@@ -237,76 +387,135 @@ void editor_set_mode(struct editor_state *editor, enum editor_mode mode)
 	editor->mode = mode;
 }
 
-static void editor_find_callback(struct editor_state* editor, char* query, int key)
+/* Mark the lines in the range [from, to) as needing to be drawn again. */
+void editor_damage_lines(struct editor_state *editor, int from, int to)
 {
-	static int last_match = -1;
-	static int direction = 1;
+	if (from < editor->damage_start)
+		editor->damage_start = from;
+	if (to > editor->damage_end)
+		editor->damage_end = to;
+}
+
+void editor_damage_all(struct editor_state *editor)
+{
+	editor->damage_start = 0;
+	editor->damage_end = INT_MAX;
+}
 
-	static int saved_highlight_line;
-	static char* saved_highlight;
+void editor_clear_damage(struct editor_state *editor)
+{
+	editor->damage_start = INT_MAX;
+	editor->damage_end = 0;
+}
 
-	if (saved_highlight) {
-		memset(editor->lines[saved_highlight_line].highlight, (size_t)saved_highlight, editor->lines[saved_highlight_line].render_size);
-		free(saved_highlight);
-		saved_highlight = NULL;
+/* Find the next match after the cursor in a direction, wrapping around the document. */
+static int editor_next_match(struct editor_state *editor, int direction)
+{
+	struct search *search = &editor->search;
+	if (search->num_matches == 0)
+		return -1;
+
+	int i = search_find_line(search, editor->cursor_y);
+	if (direction > 0) {
+		while (i < search->num_matches && search->matches[i].line == editor->cursor_y && search->matches[i].x <= editor->cursor_x)
+			i++;
+		return i == search->num_matches ? 0 : i;
 	}
 
-	/* TODO:
-	if (key == '\r' || key == '\x1b') {
-		last_match = -1;
-		direction = 1;
-		return;
-	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-		direction = 1;
-	} else if (key == ARROW_LEFT || key == ARROW_UP) {
-		direction = -1;
-	} else {
-		last_match = -1;
-		direction = 1;
+	while (i < search->num_matches && search->matches[i].line == editor->cursor_y && search->matches[i].x < editor->cursor_x)
+		i++;
+	return i == 0 ? search->num_matches - 1 : i - 1;
+}
+
+static void editor_jump_to_match(struct editor_state *editor, int match)
+{
+	editor->cursor_y = editor->search.matches[match].line;
+	editor->cursor_x = editor->search.matches[match].x;
+}
+
+/* Put the cursor on the first match from where the search started. */
+static void editor_show_first_match(struct editor_state *editor)
+{
+	struct search *search = &editor->search;
+
+	editor->cursor_x = search->origin_x;
+	editor->cursor_y = search->origin_y;
+	if (search->num_matches > 0) {
+		editor->cursor_x--;
+		editor_jump_to_match(editor, editor_next_match(editor, 1));
 	}
-	*/
-
-	if (last_match == -1)
-		direction = 1;
-	int current = last_match;	
-
-	int i;
-	for (i = 0; i < editor->num_lines; i++) {
-		current += direction;
-		if (current == -1) {
-			current = editor->num_lines - 1;
-		} else if (current == editor->num_lines) {
-			current = 0;
-		}
+}
 
-		line_t *line = &editor->lines[current];
-		char* match = strstr(line->render, query);
-		
-		if (match) {
-			last_match = current;
-			editor->cursor_y = current;
-			editor->cursor_x = row_display_x_to_x(line, match - line->render);
-			editor->line_offset = editor->num_lines;
-
-			saved_highlight_line = current;
-			saved_highlight = malloc(line->render_size);
-			memcpy(saved_highlight, line->highlight, line->render_size);
-			memset(&line->highlight[match - line->render], HIGHLIGHT_MATCH, strlen(query));
-			break;
-		}
+/* Search again as the query is typed. */
+static void find_update_callback(struct editor_state *editor, char *query, size_t length)
+{
+	if (query == NULL || length == 0)
+		editor_search_clear(editor);
+	else
+		editor_search(editor, query, length);
+	editor_show_first_match(editor);
+}
+
+/* Patterns are often invalid while they are being typed, which leaves no matches until they are finished. */
+static void find_regex_update_callback(struct editor_state *editor, char *pattern, size_t length)
+{
+	if (pattern == NULL || length == 0)
+		editor_search_clear(editor);
+	else
+		editor_search_regex(editor, pattern, length);
+	editor_show_first_match(editor);
+}
+
+static void find_callback(struct editor_state *editor, char *query, size_t length)
+{
+	/* An invalid pattern has already said what is wrong with it. */
+	if (query[0] == '\0' || editor->search.query == NULL)
+		return;
+
+	if (editor->search.num_matches == 0) {
+		editor_set_status_message(editor, "No matches for '%s'", query);
+		editor_search_clear(editor);
+	} else {
+		editor_set_status_message(editor, "%d matches for '%s'", editor->search.num_matches, query);
 	}
 }
 
 void editor_find(struct editor_state* editor)
 {
-	/* TODO: Unimplemented */
+	editor->search.origin_x = editor->cursor_x;
+	editor->search.origin_y = editor->cursor_y;
+	editor_prompt_incremental(editor, "Search", find_callback, find_update_callback);
+}
+
+void editor_find_regex(struct editor_state *editor)
+{
+	editor->search.origin_x = editor->cursor_x;
+	editor->search.origin_y = editor->cursor_y;
+	editor_prompt_incremental(editor, "Regex search", find_callback, find_regex_update_callback);
+}
+
+void editor_find_next(struct editor_state *editor, int direction)
+{
+	if (editor->search.query == NULL) {
+		editor_set_status_message(editor, "Nothing has been searched for");
+		return;
+	}
+
+	int match = editor_next_match(editor, direction);
+	if (match < 0) {
+		editor_set_status_message(editor, "No matches for '%s'", editor->search.query);
+		return;
+	}
+
+	editor_jump_to_match(editor, match);
+	editor_set_status_message(editor, "Match %d of %d", match + 1, editor->search.num_matches);
 }
 
 void editor_scroll(struct editor_state* editor)
 {
 	editor->cursor_display_x = 0;
 	if (editor->cursor_y < editor->num_lines)
-		editor->cursor_display_x = row_x_to_display_x(&editor->lines[editor->cursor_y], editor->cursor_x);
+		editor->cursor_display_x = row_x_to_display_x(document_get(&editor->document, editor->cursor_y), editor->cursor_x);
 
 	if (editor->cursor_y < editor->line_offset)
 		editor->line_offset = editor->cursor_y;
@@ -321,31 +530,36 @@ void editor_scroll(struct editor_state* editor)
 		editor->col_offset = editor->cursor_display_x - editor->screen_cols + 1;
 }
 
-void editor_update_screen_size(struct editor_state *editor)
+/* Set how much text fits on screen, given the size of the window in characters. */
+void editor_set_screen_size(struct editor_state *editor, int rows, int cols)
 {
-	window_get_size(&editor->screen_rows, &editor->screen_cols);
-	editor->screen_rows -= 2;
+	/* The bottom two rows hold the status bar and message. */
+	editor->screen_rows = rows - 2;
+	editor->screen_cols = cols;
 }
 
 void editor_draw_status_bar(struct editor_state* editor, struct textbuf *buffer)
 {
-	char status[80], right_status[80];
-	int length = snprintf(status, sizeof(status), "%.20s - %d lines %s", editor->filename ? editor->filename : "[New File]", editor->num_lines, editor->dirty ? "(modified)" : "");
+	char right_status[80];
+	size_t start = buffer->length;
+	if (editor->num_buffers > 1)
+		textbuf_printf(buffer, "[%d/%d] ", editor->current_buffer + 1, editor->num_buffers);
+	textbuf_printf(buffer, "%.20s - %d lines %s", editor->filename ? editor->filename : "[New File]", editor->num_lines, editor->dirty ? "(modified)" : "");
 	int right_length = snprintf(right_status, sizeof(right_status), "%s | %d/%d", editor->syntax ? editor->syntax->filetype : "plaintext", editor->cursor_y + 1, editor->num_lines);
 
-	if (length > editor->screen_cols)
-		length = editor->screen_cols;
+	int length = buffer->length - start;
+	if (length > editor->screen_cols) {
+		length = editor->screen_cols > 0 ? editor->screen_cols : 0;
+		buffer->length = start + length;
+	}
 
-	textbuf_append(buffer, status, length);
-	
-	while (length < editor->screen_cols) {
-		if (editor->screen_cols - length == right_length) {
-			textbuf_append(buffer, right_status, right_length);
-			break;
-		} else {
-			textbuf_append(buffer, " ", 1);
-			length++;
-		}
+	/* Right align the file type and position, if they fit. */
+	int padding = editor->screen_cols - length;
+	if (padding >= right_length) {
+		textbuf_fill(buffer, ' ', padding - right_length);
+		textbuf_append(buffer, right_status, right_length);
+	} else {
+		textbuf_fill(buffer, ' ', padding);
 	}
 	textbuf_append(buffer, "\n", 1);
 }
@@ -376,9 +590,13 @@ void editor_draw_message_bar(struct editor_state* editor, struct textbuf *buffer
 
 void editor_destroy(struct editor_state *editor)
 {
+	editor_cancel_highlight(editor);
+	linecache_store(&editor->document, editor->filename, editor->syntax, editor->highlight_frontier);
+	journal_close(editor->journal);
+	editor_free_buffers(editor);
 	free(editor->filename);
-	for (int i = 0; i < editor->num_lines; i++)
-		free_line(&editor->lines[i]);
-	free(editor->lines);
+	document_free(&editor->document);
+	search_free(&editor->search);
+	undo_free(&editor->undo);
 	textbuf_free(&editor->cmdline);
 }
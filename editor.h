@@ -3,8 +3,12 @@
 
 #include <time.h>
 
+#include "buffer.h"
+#include "document.h"
 #include "textbuf.h"
 #include "line.h"
+#include "search.h"
+#include "undo.h"
 
 enum editor_mode {
 	EDITOR_MODE_NORMAL,
@@ -20,12 +24,22 @@ struct editor_state {
 	int screen_rows;
 	int screen_cols;
 	int num_lines;
-	line_t *lines;
+	struct document document;
 	int dirty;
 	char* filename;
 	char status_message[80];
 	time_t status_message_time;
 	struct editor_syntax* syntax;
+	/* Every line above this one has been highlighted from the right state. */
+	int highlight_frontier;
+	/* Whether some of the lines are being highlighted on another thread. */
+	int highlight_pending;
+	struct search search;
+	struct undo_log undo;
+	/* Where edits are kept until they are saved, to recover them after a crash, or NULL. */
+	struct journal *journal;
+	/* The lines that have changed on screen since the last frame was drawn. */
+	int damage_start, damage_end;
 	int mode;
 	/*
 	 * Keep track of whether a key that toggles insert mode has been pressed, so
@@ -34,6 +48,12 @@ struct editor_state {
 	 */
 	int pressed_insert_key;
 	struct textbuf cmdline;
+	/* Every open file. The one at current_buffer is out of date, because it is in the fields above. */
+	struct editor_buffer *buffers;
+	int num_buffers;
+	int current_buffer;
+	/* Set once the user has asked to quit, so the editor shuts down after this event. */
+	int quit;
 };
 
 typedef void (*prompt_callback_t)(struct editor_state*, char*, size_t);
@@ -42,6 +62,10 @@ void init_editor(struct editor_state* editor);
 
 void editor_set_status_message(struct editor_state* editor, const char* format, ...);
 void editor_prompt(struct editor_state* editor, char* prompt, prompt_callback_t callback);
+void editor_prompt_incremental(struct editor_state *editor, char *prompt, prompt_callback_t callback, prompt_callback_t update);
+void editor_prompt_changed(struct editor_state *editor);
+void editor_cancel_prompt(struct editor_state *editor);
+void editor_execute_command(struct editor_state *editor, char *command);
 void editor_run_command(struct editor_state *editor);
 void editor_try_save(struct editor_state *editor);
 void editor_try_quit(struct editor_state *editor);
@@ -53,6 +77,7 @@ void editor_move_down(struct editor_state *);
 void editor_move_end(struct editor_state *);
 
 void editor_insert_char(struct editor_state* editor, int c);
+void editor_insert_text(struct editor_state *editor, const char *text, size_t length);
 void editor_insert_newline(struct editor_state* editor);
 void editor_delete_char(struct editor_state* editor);
 void editor_add_line_above(struct editor_state* editor);
@@ -60,9 +85,15 @@ void editor_add_line_below(struct editor_state* editor);
 
 void editor_set_mode(struct editor_state *editor, enum editor_mode mode);
 
+void editor_damage_lines(struct editor_state *editor, int from, int to);
+void editor_damage_all(struct editor_state *editor);
+void editor_clear_damage(struct editor_state *editor);
+
 void editor_find(struct editor_state* editor);
+void editor_find_regex(struct editor_state *editor);
+void editor_find_next(struct editor_state *editor, int direction);
 void editor_scroll(struct editor_state* editor);
-void editor_update_screen_size(struct editor_state *);
+void editor_set_screen_size(struct editor_state *, int rows, int cols);
 void editor_draw_status_bar(struct editor_state *editor, struct textbuf *buffer);
 void editor_draw_message_bar(struct editor_state *editor, struct textbuf *buffer);
 
@@ -1,49 +1,219 @@
+/* For copy_file_range */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "file.h"
 
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "error.h"
+#include "journal.h"
 #include "line.h"
+#include "linecache.h"
+#include "parallel.h"
+#include "preload.h"
+#include "scan.h"
 #include "syntax.h"
-#include "window.h"
 
-static char *lines_to_string(struct editor_state *editor, int *buffer_length)
+/* Files are split into lines on several threads, in chunks at least this big. */
+#define LOAD_MIN_CHUNK_SIZE (4 * 1024 * 1024)
+
+struct load_chunk {
+	const char *start, *end;
+	size_t num_newlines;
+	const char *last_newline;
+	/* Where the first line ending in this chunk starts, and where its lines go. */
+	const char *first_line;
+	line_t *lines;
+};
+
+/* Saves go to a file named like this next to the one being saved. */
+#define SAVE_TEMP_SUFFIX ".glypher-XXXXXX"
+
+/* The number of pieces of text written with each writev, as many as Linux allows. */
+#define SAVE_BATCH_SIZE 1024
+
+struct save_writer {
+	int fd;
+	struct iovec parts[SAVE_BATCH_SIZE];
+	int num_parts;
+	size_t written;
+	int error;
+	int can_copy_range;
+};
+
+/* Leave out the carriage returns of a line that ended in "\r\n". */
+static size_t strip_carriage_returns(const char *line, size_t length)
 {
-	int total_length = 0;
-	int j;
+	while (length > 0 && line[length - 1] == '\r')
+		length--;
+	return length;
+}
 
-	for (j = 0; j < editor->num_lines; j++)
-		total_length += editor->lines[j].size + 1;
+/* Count the newlines in a chunk and find where the last one is. */
+static void *count_chunk(void *arg)
+{
+	struct load_chunk *chunk = arg;
+
+	chunk->num_newlines = scan_count(chunk->start, chunk->end - chunk->start, '\n');
+	chunk->last_newline = NULL;
+	if (chunk->num_newlines > 0) {
+		const char *p = chunk->end;
+		while (p[-1] != '\n')
+			p--;
+		chunk->last_newline = p - 1;
+	}
 
-	*buffer_length = total_length;
+	return NULL;
+}
 
-	char* buffer = malloc(total_length);
-	char* p = buffer;
+/* Set up the lines that end in a chunk. The first may start in an earlier one. */
+static void *split_chunk(void *arg)
+{
+	struct load_chunk *chunk = arg;
+	const char *line_start = chunk->first_line;
+	const char *scan_from = chunk->start;
+	const char *newline;
+	line_t *line = chunk->lines;
 
-	for (j = 0; j < editor->num_lines; j++) {
-		memcpy(p, editor->lines[j].chars, editor->lines[j].size);
-		p += editor->lines[j].size;
-		*p = '\n';
-		p++;
+	while ((newline = memchr(scan_from, '\n', chunk->end - scan_from)) != NULL) {
+		size_t length = strip_carriage_returns(line_start, newline - line_start);
+		line_init_mapped(line++, (char *)line_start, length);
+		line_start = scan_from = newline + 1;
 	}
 
-	return buffer;
+	return NULL;
 }
 
-void editor_open(struct editor_state* editor, char* filename)
+/*
+ * Split part of the mapped file into lines, adding them to the end of the
+ * document. It is cut into one chunk per processor, and the chunks are scanned
+ * in two passes: the first counts the lines in each, so that all of the lines
+ * can be allocated at once, and the second fills them in where they belong.
+ */
+void file_split_lines(struct document *document, char *mapping, size_t size)
 {
-	free(editor->filename);
-	size_t filename_len = strlen(filename) + 1;
-	editor->filename = malloc(filename_len);
-	memcpy(editor->filename, filename, filename_len);
+	struct load_chunk chunks[PARALLEL_MAX_TASKS];
+	int num_chunks = parallel_num_tasks(size, LOAD_MIN_CHUNK_SIZE);
 
-	editor_select_syntax_highlight(editor);
-	window_set_filename(filename);
+	for (int k = 0; k < num_chunks; k++) {
+		chunks[k].start = mapping + size / num_chunks * k;
+		chunks[k].end = k == num_chunks - 1 ? mapping + size : mapping + size / num_chunks * (k + 1);
+	}
+	parallel_run(chunks, sizeof(*chunks), num_chunks, count_chunk);
+
+	/* Every newline ends a line, and there may be one more after the last. */
+	size_t num_lines = 0;
+	for (int k = 0; k < num_chunks; k++)
+		num_lines += chunks[k].num_newlines;
+	int has_last_line = mapping[size - 1] != '\n';
+	if (num_lines + has_last_line > INT_MAX - document_num_lines(document))
+		fatal_error("The file has too many lines to open\n");
+
+	line_t *lines = document_append(document, num_lines + has_last_line);
+
+	const char *line_start = mapping;
+	size_t index = 0;
+	for (int k = 0; k < num_chunks; k++) {
+		chunks[k].first_line = line_start;
+		chunks[k].lines = &lines[index];
+		index += chunks[k].num_newlines;
+		if (chunks[k].last_newline != NULL)
+			line_start = chunks[k].last_newline + 1;
+	}
+	parallel_run(chunks, sizeof(*chunks), num_chunks, split_chunk);
+
+	if (has_last_line) {
+		size_t length = strip_carriage_returns(line_start, mapping + size - line_start);
+		line_init_mapped(&lines[num_lines], (char *)line_start, length);
+	}
+}
+
+/*
+ * Map a regular file into memory and add its lines to a document, pointing
+ * into the mapping. They come from the line cache if it has them, and are
+ * found by scanning the file otherwise. Returns 0 if the file can not be
+ * mapped, for example because it is empty or is not a regular file. This does
+ * not touch the editor, so files can be loaded on other threads too.
+ */
+int file_map_document(struct document *document, int fd, const char *filename)
+{
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+
+	char *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+		return 0;
+
+	document->mapping = mapping;
+	document->mapping_size = st.st_size;
+	document->mapping_fd = dup(fd);
+	linecache_identify(&document->mapping_key, mapping, &st);
+	if (!linecache_load(document, filename, syntax_find(filename)))
+		file_split_lines(document, mapping, st.st_size);
+	document->mapping_generation = document->generation;
+	return 1;
+}
+
+/* Show a file whose lines have been put in the editor's document. */
+static void show_loaded_lines(struct editor_state *editor, int first_index)
+{
+	editor->num_lines = document_num_lines(&editor->document);
+	editor_invalidate_syntax(editor, first_index);
+	editor_damage_lines(editor, first_index, INT_MAX);
+	editor->dirty = 0;
+}
+
+static int open_mapped(struct editor_state *editor, int fd, const char *filename)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int first_index = editor->num_lines;
+	if (!file_map_document(&editor->document, fd, filename))
+		return 0;
+	show_loaded_lines(editor, first_index);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	size_t size = editor->document.mapping_size;
+	printf("Loaded %d lines (%.1f MB) in %.3f s, %.0f MB/s%s\n",
+			editor->num_lines, size / 1e6, seconds, size / 1e6 / seconds,
+			editor->document.cached_checkpoints >= 0 ? ", from the line cache" : "");
+
+	return 1;
+}
+
+/* Take the lines of a file that was loaded in the background, if it has not changed since. */
+static int open_preloaded(struct editor_state *editor, const char *filename)
+{
+	struct document document;
+	if (!preload_take(filename, &document))
+		return 0;
+
+	document_free(&editor->document);
+	editor->document = document;
+	show_loaded_lines(editor, 0);
+	printf("Loaded %d lines of %s in the background\n", editor->num_lines, filename);
+	return 1;
+}
+
+static void load_file(struct editor_state* editor, char* filename)
+{
+	if (open_preloaded(editor, filename))
+		return;
 
 	/* If there is no file with this name, the editor will create it on save. */
 	if (access(filename, F_OK) != 0)
@@ -54,16 +224,25 @@ void editor_open(struct editor_state* editor, char* filename)
 		fatal_error("Failed to read file from %s\n", filename);
 	}
 
+	if (open_mapped(editor, fileno(fp), filename)) {
+		fclose(fp);
+		editor->dirty = 0;
+		return;
+	}
+
 	char* line = NULL;
 	size_t line_capacity = 0;
 	ssize_t line_length;
 
+	/* Loading the file is not an edit, so there is nothing to undo afterwards. */
+	editor->undo.replaying = 1;
 	while ((line_length = getline(&line, &line_capacity, fp)) != -1) {
 		while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r'))
 			line_length--;
 
 		editor_insert_line(editor, editor->num_lines, line, line_length);
 	}
+	editor->undo.replaying = 0;
 
 	free(line);
 	fclose(fp);
@@ -71,35 +250,221 @@ void editor_open(struct editor_state* editor, char* filename)
 	editor->dirty = 0;
 }
 
+/* Open a file, along with any edits to it that were left in its swap file. */
+void editor_open(struct editor_state* editor, char* filename)
+{
+	free(editor->filename);
+	size_t filename_len = strlen(filename) + 1;
+	editor->filename = malloc(filename_len);
+	memcpy(editor->filename, filename, filename_len);
+
+	editor_select_syntax_highlight(editor);
+	load_file(editor, filename);
+	editor_open_journal(editor);
+}
+
+/* Write out the text of each line, collecting as many as possible per writev. */
+static void flush_parts(struct save_writer *writer)
+{
+	int first = 0;
+
+	while (first < writer->num_parts && writer->error == 0) {
+		ssize_t count = writev(writer->fd, &writer->parts[first], writer->num_parts - first);
+		if (count == -1) {
+			if (errno != EINTR)
+				writer->error = errno;
+			continue;
+		}
+		writer->written += count;
+
+		/* Carry on from wherever a short write stopped. */
+		while (first < writer->num_parts && count >= writer->parts[first].iov_len) {
+			count -= writer->parts[first].iov_len;
+			first++;
+		}
+		if (count > 0) {
+			writer->parts[first].iov_base = (char *)writer->parts[first].iov_base + count;
+			writer->parts[first].iov_len -= count;
+		}
+	}
+
+	writer->num_parts = 0;
+}
+
+static void write_part(struct save_writer *writer, const char *text, size_t size)
+{
+	if (size == 0)
+		return;
+
+	if (writer->num_parts == SAVE_BATCH_SIZE)
+		flush_parts(writer);
+	writer->parts[writer->num_parts].iov_base = (void *)text;
+	writer->parts[writer->num_parts].iov_len = size;
+	writer->num_parts++;
+}
+
+/*
+ * Copy part of the mapped file into the new one. Where it is supported, the
+ * kernel copies it without reading it into the editor, or even shares the
+ * blocks between the two files.
+ */
+static void copy_mapped_span(struct save_writer *writer, struct document *document, size_t offset, size_t size)
+{
+#ifdef __linux__
+	if (writer->can_copy_range) {
+		flush_parts(writer);
+
+		loff_t in_offset = offset;
+		while (size > 0 && writer->error == 0) {
+			ssize_t count = copy_file_range(document->mapping_fd, &in_offset, writer->fd, NULL, size, 0);
+			if (count <= 0) {
+				writer->can_copy_range = 0;
+				break;
+			}
+			writer->written += count;
+			size -= count;
+		}
+		offset = in_offset;
+	}
+#endif
+
+	/* Anything that the kernel could not copy is written from the mapping. */
+	write_part(writer, &document->mapping[offset], size);
+}
+
+/*
+ * Write every line with a newline after it. Runs of unchanged lines that are
+ * still next to each other in the mapped file are copied in one piece.
+ */
+static void write_lines(struct save_writer *writer, struct editor_state *editor)
+{
+	struct document *document = &editor->document;
+	char *mapping_end = document->mapping + document->mapping_size;
+	int j = 0;
+
+	while (j < editor->num_lines && writer->error == 0) {
+		line_t *line = document_get(document, j);
+
+		if (!line->is_mapped || document->mapping_fd == -1) {
+			write_part(writer, line->chars, line->size);
+			write_part(writer, "\n", 1);
+			j++;
+			continue;
+		}
+
+		char *start = line->chars;
+		char *end;
+		int needs_newline;
+		for (;;) {
+			end = line->chars + line->size;
+			j++;
+
+			/* Lines that ended in "\r\n" or at the end of the file get a plain newline. */
+			if (end == mapping_end || *end != '\n') {
+				needs_newline = 1;
+				break;
+			}
+
+			end++;
+			needs_newline = 0;
+			if (j == editor->num_lines)
+				break;
+
+			line = document_get(document, j);
+			if (!line->is_mapped || line->chars != end)
+				break;
+		}
+
+		copy_mapped_span(writer, document, start - document->mapping, end - start);
+		if (needs_newline)
+			write_part(writer, "\n", 1);
+	}
+
+	flush_parts(writer);
+}
+
+/* Make sure that a file renamed into a directory is on disk. */
+static void sync_directory(const char *path)
+{
+	char *directory = strdup(path);
+	char *slash = strrchr(directory, '/');
+	if (slash == directory)
+		slash[1] = '\0';
+	else if (slash != NULL)
+		*slash = '\0';
+
+	int fd = open(slash ? directory : ".", O_RDONLY);
+	if (fd != -1) {
+		fsync(fd);
+		close(fd);
+	}
+	free(directory);
+}
+
+/*
+ * Save into a new file next to the current one, and only replace the current
+ * one once everything is on disk, so that a failed save leaves it untouched.
+ * Any mapping of the old file stays valid, as it still refers to the old file.
+ */
 int file_save_current_file(struct editor_state *editor)
 {
 	/* Assume that the editor has already prompted the user for a name */
 	if (editor->filename == NULL)
 		return EINVAL;
 
-	int length;
-	char *buffer = lines_to_string(editor, &length);
+	/* Save through symbolic links, rather than replacing them. */
+	char *target = realpath(editor->filename, NULL);
+	if (target == NULL)
+		target = strdup(editor->filename);
+
+	size_t temp_size = strlen(target) + sizeof(SAVE_TEMP_SUFFIX);
+	char *temp_path = malloc(temp_size);
+	snprintf(temp_path, temp_size, "%s%s", target, SAVE_TEMP_SUFFIX);
 
-	int fd = open(editor->filename, O_RDWR | O_CREAT, 0644);
-	if (fd == -1)
-		goto fail;
+	struct save_writer writer;
+	writer.fd = mkstemp(temp_path);
+	writer.num_parts = 0;
+	writer.written = 0;
+	writer.error = 0;
+	writer.can_copy_range = 1;
+	if (writer.fd == -1) {
+		int saved_errno = errno;
+		free(temp_path);
+		free(target);
+		return saved_errno;
+	}
 
-	if (ftruncate(fd, length) == -1)
-		goto fail;
+	/* Keep the permissions of the file being replaced. */
+	struct stat st;
+	mode_t mode;
+	if (stat(target, &st) == 0) {
+		mode = st.st_mode & 07777;
+	} else {
+		mode_t mask = umask(0);
+		umask(mask);
+		mode = 0666 & ~mask;
+	}
+	fchmod(writer.fd, mode);
 
-	if (write(fd, buffer, length) != length)
-		goto fail;
+	write_lines(&writer, editor);
 
-	close(fd);
-	free(buffer);
-	editor_set_status_message(editor, "%d bytes written to disk", length);
-	editor->dirty = 0;
+	if (writer.error == 0 && fsync(writer.fd) == -1)
+		writer.error = errno;
+	if (close(writer.fd) == -1 && writer.error == 0)
+		writer.error = errno;
+	if (writer.error == 0 && rename(temp_path, target) == -1)
+		writer.error = errno;
 
-	return 0;
+	if (writer.error != 0) {
+		unlink(temp_path);
+	} else {
+		sync_directory(target);
+		editor_set_status_message(editor, "%zu bytes written to disk", writer.written);
+		editor->dirty = 0;
+		editor_journal_saved(editor);
+	}
 
-fail:
-	int saved_errno = errno;
-	close(fd);
-	free(buffer);
-	return saved_errno;
+	free(temp_path);
+	free(target);
+	return writer.error;
 }
@@ -4,6 +4,8 @@
 #include "editor.h"
 
 void editor_open(struct editor_state* editor, char* filename);
+int file_map_document(struct document *document, int fd, const char *filename);
+void file_split_lines(struct document *document, char *mapping, size_t size);
 int file_save_current_file(struct editor_state *editor);
 
 #endif
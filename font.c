@@ -3,46 +3,333 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <sys/uio.h>
 #include <zlib.h>
 
+#include "cache.h"
 #include "error.h"
 
-/* Create a texture atlas containing all of the glyphs in a font. */
-SDL_Texture *font_create_texture(SDL_Renderer *renderer, PSFFont *font)
+#define FONT_READ_BUFFER_SIZE (128 * 1024)
+
+#define ATLAS_CACHE_MAGIC 0x676c6174
+
+/* Comes before the pixels of the atlas in its cache file. */
+struct atlas_cache_header {
+	uint32_t magic;
+	uint32_t width, height, columns, num_glyphs;
+	int64_t font_size, font_mtime, font_mtime_nsec;
+};
+
+/* The eight pixels for each of the possible bytes of a glyph's bitmap. */
+static uint32_t byte_pixels[256][8];
+
+static void init_byte_pixels(void)
 {
-	SDL_Texture *result;
+	static int initialized = 0;
+	if (initialized)
+		return;
+
+	for (int byte = 0; byte < 256; byte++)
+		for (int bit = 0; bit < 8; bit++)
+			byte_pixels[byte][bit] = (byte & (0x80 >> bit)) ? 0xffffffff : 0;
+	initialized = 1;
+}
 
+/* Draw a glyph's bitmap into white and black pixels, with rows pitch pixels apart. */
+static void unpack_glyph(PSFFont *font, int glyph_idx, uint32_t *pixels, int pitch)
+{
 	const int bytes_per_row = (font->bytes_per_glyph / font->height);
-	const int texture_width = font->num_glyphs * font->width;
-	SDL_Surface *surface = SDL_CreateRGBSurface(0, texture_width, font->height, 32, 0, 0, 0, 0);
-
-	for (int glyph_idx = 0; glyph_idx < font->num_glyphs; glyph_idx++) {
-		for (int y = 0; y < font->height; y++) {
-			for (int x = 0; x < font->width; x++) {
-				/*
-				 * TODO: Make it possible for the texture atlas to have more
-				 * than one row.
-				 */
-				int xp = x + glyph_idx * font->width;
-				int yp = y;
-
-				int bit_idx = 7 - (x % 8);
-				int row_byte_idx = (glyph_idx * font->bytes_per_glyph) + y * bytes_per_row + (x / 8);
-				char current_bit = font->glyph_data[row_byte_idx] & (1 << bit_idx);
-				((Uint32*)(surface->pixels))[xp + yp * surface->w] = current_bit ? 0xffffffff : 0;
-			}
+	const uint8_t *row = &font->glyph_data[glyph_idx * font->bytes_per_glyph];
+
+	init_byte_pixels();
+
+	for (int y = 0; y < font->height; y++) {
+		/* Each byte becomes up to eight pixels, the last one maybe fewer. */
+		for (int byte = 0; byte < bytes_per_row; byte++) {
+			int count = font->width - byte * 8;
+			if (count > 8)
+				count = 8;
+			memcpy(&pixels[byte * 8], byte_pixels[row[byte]], count * sizeof(uint32_t));
 		}
+
+		row += bytes_per_row;
+		pixels += pitch;
 	}
+}
 
-	result = SDL_CreateTextureFromSurface(renderer, surface);
-	if (result == NULL)
+/*
+ * Lay out a roughly square grid with room for the given number of glyphs, or
+ * a narrower and taller one if that would be wider than max_size.
+ */
+static void size_atlas(struct glyph_atlas *atlas, PSFFont *font, int num_slots, int max_size)
+{
+	int columns = 1;
+	while ((long)columns * columns * font->width < (long)num_slots * font->height)
+		columns++;
+	if (columns > max_size / font->width && max_size / font->width > 0)
+		columns = max_size / font->width;
+
+	atlas->columns = columns;
+	atlas->num_slots = num_slots;
+	atlas->width = columns * font->width;
+	atlas->height = ((num_slots + columns - 1) / columns) * font->height;
+}
+
+/* Fills in the pixels of a whole atlas from the cache, if they are there. */
+static int load_cached_atlas(struct glyph_atlas *atlas, PSFFont *font)
+{
+	char *path = cache_path("atlas", font->filename);
+	if (path == NULL)
+		return 0;
+
+	size_t size;
+	struct atlas_cache_header *header = cache_map(path, &size);
+	free(path);
+	if (header == NULL)
+		return 0;
+
+	int matches = size == sizeof(*header) + (size_t)atlas->width * atlas->height * sizeof(uint32_t)
+		&& header->magic == ATLAS_CACHE_MAGIC
+		&& header->font_size == font->file_stat.st_size
+		&& header->font_mtime == font->file_stat.st_mtim.tv_sec
+		&& header->font_mtime_nsec == font->file_stat.st_mtim.tv_nsec
+		&& header->width == atlas->width && header->height == atlas->height
+		&& header->columns == atlas->columns && header->num_glyphs == font->num_glyphs;
+
+	if (matches)
+		SDL_UpdateTexture(atlas->texture, NULL, header + 1, atlas->width * sizeof(uint32_t));
+
+	cache_unmap(header, size);
+	return matches;
+}
+
+static void store_cached_atlas(struct glyph_atlas *atlas, PSFFont *font, uint32_t *pixels)
+{
+	char *path = cache_path("atlas", font->filename);
+	if (path == NULL)
+		return;
+
+	struct atlas_cache_header header = {
+		ATLAS_CACHE_MAGIC,
+		atlas->width, atlas->height, atlas->columns, font->num_glyphs,
+		font->file_stat.st_size, font->file_stat.st_mtim.tv_sec, font->file_stat.st_mtim.tv_nsec
+	};
+	struct iovec parts[] = {
+		{ &header, sizeof(header) },
+		{ pixels, (size_t)atlas->width * atlas->height * sizeof(uint32_t) }
+	};
+
+	if (!cache_store(path, parts, 2))
+		warning("Failed to cache the font atlas");
+	free(path);
+}
+
+/* Create a texture atlas for the glyphs of a font. */
+struct glyph_atlas font_create_atlas(SDL_Renderer *renderer, PSFFont *font)
+{
+	struct glyph_atlas atlas;
+
+	int max_size = INT_MAX;
+	SDL_RendererInfo info;
+	if (SDL_GetRendererInfo(renderer, &info) == 0 && info.max_texture_width > 0)
+		max_size = info.max_texture_width < info.max_texture_height ? info.max_texture_width : info.max_texture_height;
+
+	/* Fonts that are too big to put in the atlas at once are cached instead. */
+	size_atlas(&atlas, font, font->num_glyphs, max_size);
+	atlas.glyph_slots = NULL;
+	atlas.glyph_pixels = NULL;
+	if (font->num_glyphs > GLYPH_CACHE_SLOTS || atlas.width > max_size || atlas.height > max_size) {
+		/* The cache has as many slots as fit in the largest texture, up to GLYPH_CACHE_SLOTS. */
+		long long fitting = (long long)(max_size / font->width) * (max_size / font->height);
+		size_atlas(&atlas, font, fitting < GLYPH_CACHE_SLOTS ? fitting : GLYPH_CACHE_SLOTS, max_size);
+		atlas.glyph_slots = malloc(sizeof(int) * font->num_glyphs);
+		atlas.glyph_pixels = malloc(sizeof(uint32_t) * font->width * font->height);
+	}
+
+	if (atlas.width > max_size || atlas.height > max_size)
+		fatal_error("Font atlas of size %dx%d is larger than the maximum texture size %d\n", atlas.width, atlas.height, max_size);
+
+	atlas.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, atlas.width, atlas.height);
+	if (atlas.texture == NULL)
 		fatal_error("Failed to create texture: %s\n", SDL_GetError());
 
-	SDL_FreeSurface(surface);
+	if (atlas.glyph_slots == NULL && !load_cached_atlas(&atlas, font)) {
+		uint32_t *pixels = calloc((size_t)atlas.width * atlas.height, sizeof(uint32_t));
+		for (int glyph_idx = 0; glyph_idx < font->num_glyphs; glyph_idx++) {
+			int xp = (glyph_idx % atlas.columns) * font->width;
+			int yp = (glyph_idx / atlas.columns) * font->height;
+			unpack_glyph(font, glyph_idx, &pixels[xp + yp * atlas.width], atlas.width);
+		}
+
+		SDL_UpdateTexture(atlas.texture, NULL, pixels, atlas.width * sizeof(uint32_t));
+		store_cached_atlas(&atlas, font, pixels);
+		free(pixels);
+	} else if (atlas.glyph_slots != NULL) {
+		font_atlas_clear(&atlas, font);
+	}
+
+	printf("Created font texture atlas of size %dx%d with %d slots\n", atlas.width, atlas.height, atlas.num_slots);
+	return atlas;
+}
+
+/*
+ * Find the slot of the atlas holding a glyph, copying it into a free one if it
+ * is not there yet. Returns -1 if the atlas has to be cleared to make room.
+ */
+int font_atlas_slot(struct glyph_atlas *atlas, PSFFont *font, int glyph_index)
+{
+	if (atlas->glyph_slots == NULL)
+		return glyph_index;
+
+	int slot = atlas->glyph_slots[glyph_index];
+	if (slot >= 0)
+		return slot;
+	if (atlas->used_slots == atlas->num_slots)
+		return -1;
+
+	slot = atlas->used_slots++;
+	unpack_glyph(font, glyph_index, atlas->glyph_pixels, font->width);
+
+	SDL_Rect rect = { (slot % atlas->columns) * font->width, (slot / atlas->columns) * font->height, font->width, font->height };
+	SDL_UpdateTexture(atlas->texture, &rect, atlas->glyph_pixels, font->width * sizeof(uint32_t));
+
+	atlas->glyph_slots[glyph_index] = slot;
+	return slot;
+}
+
+/* Forget which glyphs are in the atlas, so that every slot can be reused. */
+void font_atlas_clear(struct glyph_atlas *atlas, PSFFont *font)
+{
+	if (atlas->glyph_slots == NULL)
+		return;
+
+	memset(atlas->glyph_slots, 0xff, sizeof(int) * font->num_glyphs);
+	atlas->used_slots = 0;
+}
+
+void font_atlas_destroy(struct glyph_atlas *atlas)
+{
+	SDL_DestroyTexture(atlas->texture);
+	free(atlas->glyph_slots);
+	free(atlas->glyph_pixels);
+}
+
+/* Read everything that is left in a file. */
+static uint8_t *read_remaining(gzFile file, size_t *size)
+{
+	size_t capacity = 65536;
+	size_t length = 0;
+	uint8_t *data = malloc(capacity);
+	int count;
+
+	while ((count = gzread(file, &data[length], capacity - length)) > 0) {
+		length += count;
+		if (length == capacity) {
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+	}
+
+	*size = length;
+	return data;
+}
+
+/* Decode a UTF-8 character. Returns its length, or 0 if it is not valid. */
+static int decode_utf8(const uint8_t *text, size_t size, uint32_t *codepoint)
+{
+	int length;
+	uint32_t value;
+
+	if (text[0] < 0x80) {
+		*codepoint = text[0];
+		return 1;
+	} else if ((text[0] & 0xe0) == 0xc0) {
+		length = 2;
+		value = text[0] & 0x1f;
+	} else if ((text[0] & 0xf0) == 0xe0) {
+		length = 3;
+		value = text[0] & 0x0f;
+	} else if ((text[0] & 0xf8) == 0xf0) {
+		length = 4;
+		value = text[0] & 0x07;
+	} else {
+		return 0;
+	}
+
+	if (size < length)
+		return 0;
+	for (int i = 1; i < length; i++) {
+		if ((text[i] & 0xc0) != 0x80)
+			return 0;
+		value = (value << 6) | (text[i] & 0x3f);
+	}
+
+	*codepoint = value;
+	return length;
+}
+
+static void map_codepoint(PSFFont *font, uint32_t codepoint, int glyph_index)
+{
+	if (codepoint >= UNICODE_NUM_PAGES * UNICODE_PAGE_SIZE)
+		return;
+
+	uint32_t **page = &font->unicode_pages[codepoint / UNICODE_PAGE_SIZE];
+	if (*page == NULL)
+		*page = calloc(UNICODE_PAGE_SIZE, sizeof(uint32_t));
 
-	printf("Created font texture atlas of size %dx%d\n", surface->w, surface->h);
-	return result;
+	/* The first glyph listed for a code point is the one that is used. */
+	if ((*page)[codepoint % UNICODE_PAGE_SIZE] == 0)
+		(*page)[codepoint % UNICODE_PAGE_SIZE] = glyph_index + 1;
+}
+
+/*
+ * The unicode table lists the UTF-8 characters of each glyph in order, ending
+ * each glyph with 0xff. Sequences of combining characters follow a 0xfe and
+ * are skipped, as a glyph is only looked up by a single code point.
+ */
+static void parse_unicode_table(PSFFont *font, const uint8_t *table, size_t size)
+{
+	int glyph_index = 0;
+	int in_sequences = 0;
+	size_t i = 0;
+
+	while (i < size && glyph_index < font->num_glyphs) {
+		if (table[i] == 0xff) {
+			glyph_index++;
+			in_sequences = 0;
+			i++;
+		} else if (table[i] == 0xfe || in_sequences) {
+			in_sequences = 1;
+			i++;
+		} else {
+			uint32_t codepoint;
+			int length = decode_utf8(&table[i], size - i, &codepoint);
+			if (length == 0) {
+				i++;
+				continue;
+			}
+
+			map_codepoint(font, codepoint, glyph_index);
+			i += length;
+		}
+	}
+}
+
+/* Find the glyph to draw for a code point. */
+int font_glyph_index(PSFFont *font, uint32_t codepoint)
+{
+	if (font->unicode_pages == NULL)
+		return codepoint < font->num_glyphs ? (int)codepoint : font->fallback_glyph;
+
+	if (codepoint >= UNICODE_NUM_PAGES * UNICODE_PAGE_SIZE)
+		return font->fallback_glyph;
+
+	uint32_t *page = font->unicode_pages[codepoint / UNICODE_PAGE_SIZE];
+	if (page == NULL || page[codepoint % UNICODE_PAGE_SIZE] == 0)
+		return font->fallback_glyph;
+	return page[codepoint % UNICODE_PAGE_SIZE] - 1;
 }
 
 PSFFont font_load(const char *filename)
@@ -53,43 +340,50 @@ PSFFont font_load(const char *filename)
 	if (!file)
 		fatal_error("Failed to open font from '%s'\n", filename);
 
-	gzread(file, &font.magic, 4);
+	/* Decompress in large pieces rather than a few kilobytes at a time. */
+	gzbuffer(file, FONT_READ_BUFFER_SIZE);
+
+	uint32_t header[8];
+	if (gzread(file, header, sizeof(header)) != sizeof(header))
+		fatal_error("Font '%s' is too short to be a PSF font\n", filename);
+
+	font.magic = header[0];
 	if (font.magic != PSF_MAGIC_NUMBER)
 		fatal_error("Font header mismatch! '%s' has magic value %x.\n", filename, font.magic);
 
-	gzread(file, &font.version, 4);
-	gzread(file, &font.header_size, 4);
-	gzread(file, &font.flags, 4);
-	gzread(file, &font.num_glyphs, 4);
-	gzread(file, &font.bytes_per_glyph, 4);
-	gzread(file, &font.height, 4);
-	gzread(file, &font.width, 4);
+	font.version = header[1];
+	font.header_size = header[2];
+	font.flags = header[3];
+	font.num_glyphs = header[4];
+	font.bytes_per_glyph = header[5];
+	font.height = header[6];
+	font.width = header[7];
 
-	size_t glyph_buffer_size = font.num_glyphs * font.bytes_per_glyph;
+	size_t glyph_buffer_size = (size_t)font.num_glyphs * font.bytes_per_glyph;
 	font.glyph_data = malloc(glyph_buffer_size);
 	gzseek(file, font.header_size, SEEK_SET);
-	gzread(file, font.glyph_data, font.bytes_per_glyph * font.num_glyphs);
-
-	font.unicode_desc = NULL;
-	if (font.flags == PSF_FLAG_UNICODE) {
-		/* Store the file's unicode information in a buffer. */
-		char *desc = malloc(UNICODE_TABLE_SIZE);
-		gzread(file, desc, UNICODE_TABLE_SIZE);
-
-		/* Create a buffer in our object to map character codes to glyphs */
-		font.unicode_desc = calloc(USHRT_MAX, 2);
-
-		int glyph_index = 0;
-		unsigned char letter = 0;
-		for (int i = 0; i < UNICODE_TABLE_SIZE; i++) {
-			unsigned char uc = desc[i];
-			if (uc == 0xff) {
-				font.unicode_desc[letter] = glyph_index;
-				glyph_index++;
-			} else {
-				letter = uc;
-			}
-		}
+	if (gzread(file, font.glyph_data, glyph_buffer_size) != glyph_buffer_size)
+		fatal_error("Font '%s' ends before its last glyph\n", filename);
+
+	/* The atlas cache is only used while it is newer than the font. */
+	font.filename = strdup(filename);
+	if (stat(filename, &font.file_stat) != 0)
+		memset(&font.file_stat, 0, sizeof(font.file_stat));
+
+	font.unicode_pages = NULL;
+	font.fallback_glyph = 0;
+	if (font.flags & PSF_FLAG_UNICODE) {
+		size_t table_size;
+		uint8_t *table = read_remaining(file, &table_size);
+
+		font.unicode_pages = calloc(UNICODE_NUM_PAGES, sizeof(uint32_t *));
+		parse_unicode_table(&font, table, table_size);
+		free(table);
+
+		/* Prefer the replacement character for anything that is missing. */
+		font.fallback_glyph = font_glyph_index(&font, 0xfffd);
+		if (font.fallback_glyph == 0)
+			font.fallback_glyph = font_glyph_index(&font, '?');
 	}
 
 	gzclose(file);
@@ -102,5 +396,11 @@ PSFFont font_load(const char *filename)
 void font_destroy(PSFFont *font)
 {
 	free(font->glyph_data);
-	free(font->unicode_desc);
+	free(font->filename);
+
+	if (font->unicode_pages != NULL) {
+		for (int page = 0; page < UNICODE_NUM_PAGES; page++)
+			free(font->unicode_pages[page]);
+		free(font->unicode_pages);
+	}
 }
@@ -2,12 +2,20 @@
 #define _FONT_H
 
 #include <SDL2/SDL.h>
+#include <sys/stat.h>
 
 #define PSF_MAGIC_NUMBER 0x864ab572
 #define PSF_FLAG_UNICODE 1
 
-/* TODO: It would be nice if this could be calculated while loading the font */
-#define UNICODE_TABLE_SIZE 1024
+/* The unicode table maps code points to glyphs in pages of this many. */
+#define UNICODE_PAGE_SIZE 256
+#define UNICODE_NUM_PAGES (0x110000 / UNICODE_PAGE_SIZE)
+
+/*
+ * Fonts with more glyphs than this get an atlas of this many slots, which are
+ * filled in as the glyphs are first drawn.
+ */
+#define GLYPH_CACHE_SLOTS 1024
 
 typedef struct {
 	uint32_t magic;
@@ -19,11 +27,37 @@ typedef struct {
 	uint32_t height;
 	uint32_t width;
 	uint8_t *glyph_data;
-	uint16_t *unicode_desc;
+	/* Glyph index plus one for each code point, NULL for unused pages. */
+	uint32_t **unicode_pages;
+	/* Drawn for code points that the font has no glyph for. */
+	int fallback_glyph;
+	char *filename;
+	struct stat file_stat;
 } PSFFont;
 
+/*
+ * A texture with a grid of glyph slots. Small fonts are put in it completely,
+ * with each glyph in the slot of the same index. Otherwise, glyphs are copied
+ * into free slots the first time they are looked up.
+ */
+struct glyph_atlas {
+	SDL_Texture *texture;
+	int width, height;
+	int columns;
+	int num_slots;
+	int used_slots;
+	/* Slot of each glyph, or -1. NULL if every glyph is in the atlas. */
+	int *glyph_slots;
+	uint32_t *glyph_pixels;
+};
+
 PSFFont font_load(const char *);
-SDL_Texture *font_create_texture(SDL_Renderer *, PSFFont *);
+int font_glyph_index(PSFFont *, uint32_t codepoint);
 void font_destroy(PSFFont *);
 
+struct glyph_atlas font_create_atlas(SDL_Renderer *, PSFFont *);
+int font_atlas_slot(struct glyph_atlas *, PSFFont *, int glyph_index);
+void font_atlas_clear(struct glyph_atlas *, PSFFont *);
+void font_atlas_destroy(struct glyph_atlas *);
+
 #endif
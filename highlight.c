@@ -0,0 +1,358 @@
+#include "highlight.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "document.h"
+#include "editor.h"
+#include "error.h"
+#include "syntax.h"
+
+/* Stop adding lines to a job once it holds this much text or this many lines. */
+#define JOB_MAX_BYTES (256 * 1024)
+#define JOB_MAX_LINES 4096
+
+/* How many already highlighted lines to step over on the main thread at once. */
+#define MAX_SKIPPED_LINES 100000
+
+struct job_line {
+	unsigned int version;
+	size_t text_offset;
+	int size;
+	/* Lines that have not been drawn only need their end state. */
+	int has_render;
+	/*
+	 * The state this line was last highlighted from, or -1 if its text has
+	 * changed since. The job can stop early once it reaches a line that was
+	 * already highlighted from the right state.
+	 */
+	int previous_start_comment;
+
+	int open_comment;
+	/* The highlighting as runs, which start at the same index in the job's spans as the text. */
+	int num_spans;
+};
+
+struct highlight_job {
+	struct editor_state *editor;
+	struct editor_syntax *syntax;
+	unsigned int generation;
+	int first_line;
+	int start_comment;
+
+	char *text;
+	/* The highlighting of every line, at the same offsets as the text. */
+	unsigned char *highlight;
+	struct highlight_span *spans;
+	int num_lines;
+	struct job_line *lines;
+	/* Filled in by the highlighting thread. */
+	int num_done;
+
+	struct highlight_job *next;
+};
+
+static pthread_t thread;
+static int thread_running = 0;
+static int thread_quit = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct highlight_job *pending_jobs = NULL;
+static struct highlight_job *done_jobs = NULL;
+static void (*notify_callback)(void);
+
+static void free_job(struct highlight_job *job)
+{
+	free(job->lines);
+	free(job->text);
+	free(job->highlight);
+	free(job->spans);
+	free(job);
+}
+
+static void push_job(struct highlight_job **list, struct highlight_job *job)
+{
+	job->next = NULL;
+	while (*list != NULL)
+		list = &(*list)->next;
+	*list = job;
+}
+
+/* Remove and return the first job in the list that belongs to the editor. */
+static struct highlight_job *take_job(struct highlight_job **list, struct editor_state *editor)
+{
+	for (; *list != NULL; list = &(*list)->next) {
+		struct highlight_job *job = *list;
+		if (editor == NULL || job->editor == editor) {
+			*list = job->next;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static void run_job(struct highlight_job *job)
+{
+	int in_comment = job->start_comment;
+	int i;
+
+	for (i = 0; i < job->num_lines; i++) {
+		struct job_line *line = &job->lines[i];
+
+		if (i > 0 && line->previous_start_comment == in_comment)
+			break;
+
+		const char *text = &job->text[line->text_offset];
+		unsigned char *highlight = NULL;
+		if (line->has_render) {
+			highlight = &job->highlight[line->text_offset];
+			memset(highlight, HIGHLIGHT_NORMAL, line->size);
+		}
+
+		line->open_comment = 0;
+		line->num_spans = 0;
+		if (job->syntax != NULL) {
+			line->open_comment = syntax_highlight_text(job->syntax, text, line->size, highlight, in_comment);
+			if (highlight != NULL)
+				line->num_spans = line_encode_spans(highlight, line->size, &job->spans[line->text_offset]);
+		}
+		in_comment = line->open_comment;
+	}
+
+	job->num_done = i;
+}
+
+static void *highlight_thread(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (pending_jobs == NULL && !thread_quit)
+			pthread_cond_wait(&cond, &lock);
+		if (thread_quit)
+			break;
+
+		struct highlight_job *job = take_job(&pending_jobs, NULL);
+		pthread_mutex_unlock(&lock);
+
+		run_job(job);
+
+		pthread_mutex_lock(&lock);
+		push_job(&done_jobs, job);
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&lock);
+
+		notify_callback();
+
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void highlight_start(void (*notify)(void))
+{
+	notify_callback = notify;
+	thread_quit = 0;
+	if (pthread_create(&thread, NULL, highlight_thread, NULL) != 0)
+		fatal_error("Failed to start the highlighting thread\n");
+	thread_running = 1;
+}
+
+void highlight_stop(void)
+{
+	if (!thread_running)
+		return;
+
+	pthread_mutex_lock(&lock);
+	thread_quit = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	thread_running = 0;
+
+	struct highlight_job *job;
+	while ((job = take_job(&pending_jobs, NULL)) != NULL)
+		free_job(job);
+	while ((job = take_job(&done_jobs, NULL)) != NULL)
+		free_job(job);
+}
+
+static int line_start_comment(struct editor_state *editor, int index)
+{
+	return index > 0 && document_get(&editor->document, index - 1)->highlight_open_comment;
+}
+
+/* Copy the lines from the frontier onwards into a new job. */
+static struct highlight_job *create_job(struct editor_state *editor)
+{
+	struct highlight_job *job = malloc(sizeof(*job));
+	job->editor = editor;
+	job->syntax = editor->syntax;
+	job->generation = editor->document.generation;
+	job->first_line = editor->highlight_frontier;
+	job->start_comment = line_start_comment(editor, job->first_line);
+	job->num_done = 0;
+
+	int num_lines = 0;
+	size_t text_size = 0;
+	while (job->first_line + num_lines < editor->num_lines && num_lines < JOB_MAX_LINES && text_size < JOB_MAX_BYTES) {
+		line_t *line = document_get(&editor->document, job->first_line + num_lines);
+		text_size += line->render ? line->render_size : line->size;
+		num_lines++;
+	}
+
+	job->num_lines = num_lines;
+	job->lines = malloc(sizeof(struct job_line) * num_lines);
+	job->text = malloc(text_size ? text_size : 1);
+	job->highlight = malloc(text_size ? text_size : 1);
+	job->spans = malloc(sizeof(struct highlight_span) * (text_size ? text_size : 1));
+
+	size_t offset = 0;
+	for (int i = 0; i < num_lines; i++) {
+		line_t *line = document_get(&editor->document, job->first_line + i);
+		struct job_line *job_line = &job->lines[i];
+
+		job_line->version = line->version;
+		job_line->text_offset = offset;
+		job_line->has_render = (line->render != NULL);
+		job_line->size = job_line->has_render ? line->render_size : line->size;
+		job_line->previous_start_comment = line->highlight_dirty ? -1 : line->highlight_start_comment;
+
+		memcpy(&job->text[offset], job_line->has_render ? line->render : line->chars, job_line->size);
+		offset += job_line->size;
+	}
+
+	return job;
+}
+
+/* Copy the results of a job into lines that have not changed since it started. */
+static int apply_job(struct highlight_job *job)
+{
+	struct editor_state *editor = job->editor;
+	int changed = 0;
+
+	if (job->generation != editor->document.generation || job->syntax != editor->syntax)
+		return 0;
+	if (job->first_line != editor->highlight_frontier || job->start_comment != line_start_comment(editor, job->first_line))
+		return 0;
+
+	int in_comment = job->start_comment;
+	for (int i = 0; i < job->num_done; i++) {
+		line_t *line = document_get(&editor->document, job->first_line + i);
+		struct job_line *job_line = &job->lines[i];
+
+		if (line->version != job_line->version)
+			break;
+
+		if (job_line->has_render) {
+			line_set_spans(&editor->document, line, &job->spans[job_line->text_offset], job_line->num_spans);
+			editor_damage_lines(editor, job->first_line + i, job->first_line + i + 1);
+			changed = 1;
+		}
+
+		line->highlight_start_comment = in_comment;
+		line->highlight_open_comment = job_line->open_comment;
+		line->highlight_dirty = 0;
+		in_comment = job_line->open_comment;
+		editor->highlight_frontier++;
+	}
+
+	return changed;
+}
+
+static int needs_highlight(struct editor_state *editor, int index)
+{
+	line_t *line = document_get(&editor->document, index);
+	return line->highlight_dirty || line->highlight_start_comment != line_start_comment(editor, index);
+}
+
+/*
+ * Step the frontier over lines that are already highlighted from the right
+ * state, stopping after a while so that the main thread stays responsive.
+ * Returns whether the frontier stopped at a line that needs highlighting.
+ */
+static int skip_highlighted_lines(struct editor_state *editor)
+{
+	for (int skipped = 0; skipped < MAX_SKIPPED_LINES; skipped++) {
+		if (editor->highlight_frontier >= editor->num_lines)
+			return 0;
+		if (needs_highlight(editor, editor->highlight_frontier))
+			return 1;
+		editor->highlight_frontier++;
+	}
+	return 0;
+}
+
+void editor_request_highlight(struct editor_state *editor)
+{
+	if (editor->highlight_pending)
+		return;
+
+	if (!thread_running) {
+		while (editor->highlight_frontier < editor->num_lines) {
+			if (!skip_highlighted_lines(editor))
+				continue;
+
+			struct highlight_job *job = create_job(editor);
+			run_job(job);
+			apply_job(job);
+			free_job(job);
+		}
+		return;
+	}
+
+	if (!skip_highlighted_lines(editor)) {
+		/* Come back later if there are more lines to step over. */
+		if (editor->highlight_frontier < editor->num_lines)
+			notify_callback();
+		return;
+	}
+
+	struct highlight_job *job = create_job(editor);
+	editor->highlight_pending = 1;
+
+	pthread_mutex_lock(&lock);
+	push_job(&pending_jobs, job);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+int editor_collect_highlight(struct editor_state *editor)
+{
+	int changed = 0;
+	struct highlight_job *job;
+
+	pthread_mutex_lock(&lock);
+	job = take_job(&done_jobs, editor);
+	pthread_mutex_unlock(&lock);
+
+	if (job != NULL) {
+		editor->highlight_pending = 0;
+		changed = apply_job(job);
+		free_job(job);
+	}
+
+	editor_request_highlight(editor);
+	return changed;
+}
+
+void editor_cancel_highlight(struct editor_state *editor)
+{
+	/* Any jobs left over when the thread stopped have already been freed. */
+	if (!editor->highlight_pending || !thread_running) {
+		editor->highlight_pending = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	struct highlight_job *job = take_job(&pending_jobs, editor);
+	while (job == NULL && (job = take_job(&done_jobs, editor)) == NULL)
+		pthread_cond_wait(&done_cond, &lock);
+	pthread_mutex_unlock(&lock);
+
+	free_job(job);
+	editor->highlight_pending = 0;
+}
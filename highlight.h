@@ -0,0 +1,36 @@
+/*
+ * highlight.h: Syntax highlighting on a background thread.
+ *
+ * The main thread hands the highlighting thread copies of the text of lines
+ * that need to be highlighted, starting at the editor's highlight frontier.
+ * The results are applied back on the main thread, but only to lines that
+ * have not changed since they were copied. Lines are drawn without colours
+ * until their results are in.
+ */
+
+#ifndef _HIGHLIGHT_H
+#define _HIGHLIGHT_H
+
+struct editor_state;
+
+/*
+ * Start the highlighting thread. The notify function is called from that
+ * thread whenever results are ready to be collected. Without the thread,
+ * highlighting is done straight away on the thread that asks for it.
+ */
+void highlight_start(void (*notify)(void));
+void highlight_stop(void);
+
+/* Hand the next lines that need highlighting to the highlighting thread. */
+void editor_request_highlight(struct editor_state *editor);
+
+/*
+ * Apply finished results to the editor and ask for more highlighting. Returns
+ * whether any lines changed.
+ */
+int editor_collect_highlight(struct editor_state *editor);
+
+/* Wait for and throw away any highlighting still being done for the editor. */
+void editor_cancel_highlight(struct editor_state *editor);
+
+#endif
@@ -4,18 +4,25 @@
 #include "file.h"
 #include "line.h"
 
-void input_process_textinput(struct editor_state *editor, const char *text)
+/* Apply some typed text, which may be several text input events' worth that arrived together. */
+void input_process_textinput(struct editor_state *editor, const char *text, size_t length)
 {
-	/* Ignore the first letter after entering insert mode. */
-	if (editor->pressed_insert_key) {
+	/* Ignore the first letter after entering insert mode, along with the rest of its UTF-8 sequence. */
+	if (editor->pressed_insert_key && length > 0) {
 		editor->pressed_insert_key = 0;
-		return;
+		do {
+			text++;
+			length--;
+		} while (length > 0 && ((unsigned char)*text & 0xc0) == 0x80);
 	}
+	if (length == 0)
+		return;
 
 	if (editor->mode == EDITOR_MODE_INSERT) {
-		editor_insert_char(editor, *text);
+		editor_insert_text(editor, text, length);
 	} else if (editor->mode == EDITOR_MODE_PROMPT) {
-		textbuf_append(&editor->cmdline, text, 1);
+		textbuf_append(&editor->cmdline, text, length);
+		editor_prompt_changed(editor);
 	}
 }
 
@@ -38,17 +45,22 @@ void editor_process_keypress(struct editor_state *editor, SDL_Keysym *keysym)
 	}
 
 	if (editor->mode == EDITOR_MODE_PROMPT) {
-		if (keysym->sym == SDLK_BACKSPACE)
+		if (keysym->sym == SDLK_BACKSPACE) {
 			textbuf_delete(&editor->cmdline);
+			editor_prompt_changed(editor);
+		}
 
 		if (keysym->sym == SDLK_RETURN)
 			editor_run_command(editor);
 
 		if (keysym->sym == SDLK_ESCAPE)
-			editor_set_mode(editor, EDITOR_MODE_NORMAL);
+			editor_cancel_prompt(editor);
 		return;
 	}
 
+	/* Each command is undone on its own, along with anything typed after it. */
+	undo_start_change(&editor->undo);
+
 	switch (keysym->sym) {
 		/* TODO: Reimplement page up/down on Shift+W/S. */
 		case SDLK_w:
@@ -102,7 +114,20 @@ void editor_process_keypress(struct editor_state *editor, SDL_Keysym *keysym)
 			editor_set_mode(editor, EDITOR_MODE_INSERT);
 			break;
 		case SDLK_SLASH:
-			editor_find(editor);
+			if (keysym->mod & KMOD_SHIFT)
+				editor_find_regex(editor);
+			else
+				editor_find(editor);
+			break;
+		case SDLK_u:
+			editor_undo(editor);
+			break;
+		case SDLK_r:
+			if (keysym->mod & KMOD_CTRL)
+				editor_redo(editor);
+			break;
+		case SDLK_f:
+			editor_find_next(editor, (keysym->mod & KMOD_SHIFT) ? -1 : 1);
 			break;
 		case SDLK_SEMICOLON:
 			if (keysym->mod & KMOD_SHIFT)
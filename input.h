@@ -4,7 +4,7 @@
 #include "editor.h"
 #include <SDL2/SDL_keyboard.h>
 
-void input_process_textinput(struct editor_state *editor, const char *text);
+void input_process_textinput(struct editor_state *editor, const char *text, size_t length);
 void editor_process_keypress(struct editor_state *editor, SDL_Keysym *keysym);
 
 #endif
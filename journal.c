@@ -0,0 +1,842 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "document.h"
+#include "editor.h"
+#include "error.h"
+#include "file.h"
+#include "line.h"
+#include "syntax.h"
+#include "textbuf.h"
+#include "undo.h"
+
+#define JOURNAL_MAGIC 0x316c6a67
+
+enum journal_type {
+	JOURNAL_INSERT_TEXT,
+	JOURNAL_DELETE_TEXT,
+	JOURNAL_INSERT_LINE,
+	JOURNAL_DELETE_LINE,
+	/* A snapshot is made of runs of lines that are still as they were in the file, and lines with their text. */
+	JOURNAL_FILE_LINES,
+	JOURNAL_LINE
+};
+
+struct journal_header {
+	uint32_t magic;
+	/* Whether the records start with a snapshot of every line, rather than from the file. */
+	uint32_t has_snapshot;
+	/* The editor that wrote the journal, to tell whether it is still running. */
+	int64_t pid;
+	/* The file the edits were made to, or a size of -1 if there was no file. */
+	int64_t base_size;
+	int64_t base_mtime;
+	int64_t base_mtime_nsec;
+};
+
+/* An edit or a line of a snapshot, which is followed by the text it inserted, if any. */
+struct journal_record {
+	unsigned char type;
+	int line;
+	/* The length of the text, or how many bytes of the file a run of lines takes up. */
+	long long length;
+	/* The column of an edit to a line's text, or where a run of lines starts in the file. */
+	long long x;
+};
+
+struct journal {
+	/* The swap file to write to, and the file the edits are made to. */
+	char *path;
+	struct journal_header header;
+	/* Records waiting to be written, and where the last of them starts, or -1. */
+	struct textbuf pending;
+	long last_record;
+	/* A snapshot that replaces everything written so far. */
+	struct textbuf snapshot;
+	int has_snapshot;
+	/* Set when the swap file is out of date, because the file has been saved since. */
+	int restart;
+	/* Set while the thread is writing the journal out. */
+	int busy;
+
+	/* Only used by the thread while it writes: the swap file that has been written, and what is being written to it. */
+	char *written_path;
+	int fd;
+	int failed;
+	struct textbuf writing;
+	struct textbuf writing_snapshot;
+
+	/* Only used on the main thread, to decide when to compact the journal. */
+	size_t recorded;
+	size_t snapshot_size;
+	/* Whether lines that point into the document's mapping are lines of the file the journal starts from. */
+	int base_is_mapping;
+	/*
+	 * A snapshot that is built a step at a time: the lines before build_line
+	 * have been taken, the last of them maybe in a run that is not added yet,
+	 * from run_start to run_end in the mapping, or -1. The edits made since
+	 * to the lines it has taken are kept to be written after it.
+	 */
+	int building;
+	int build_line;
+	struct textbuf build;
+	long long run_start, run_end;
+	struct textbuf build_edits;
+	long build_last_record;
+
+	struct journal *previous, *next;
+};
+
+static pthread_t thread;
+static int thread_running = 0;
+static int thread_quit = 0;
+static int flush_requested = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct journal *journals = NULL;
+
+/* The swap file of "dir/name" is "dir/.name.glypher-swap". */
+static char *swap_path(const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+	int directory_length = slash ? slash - filename + 1 : 0;
+	size_t size = strlen(filename) + sizeof(JOURNAL_SWAP_SUFFIX) + 1;
+	char *path = malloc(size);
+	snprintf(path, size, "%.*s.%s%s", directory_length, filename, filename + directory_length, JOURNAL_SWAP_SUFFIX);
+	return path;
+}
+
+/* Describe the file as it is on disk now, for edits that are made from here on. */
+static void identify_base(struct journal_header *header, const char *filename)
+{
+	memset(header, 0, sizeof(*header));
+	header->magic = JOURNAL_MAGIC;
+	header->pid = getpid();
+	header->base_size = -1;
+
+	struct stat st;
+	if (stat(filename, &st) == 0) {
+		header->base_size = st.st_size;
+		header->base_mtime = st.st_mtim.tv_sec;
+		header->base_mtime_nsec = st.st_mtim.tv_nsec;
+	}
+}
+
+static int same_base(const struct journal_header *a, const struct journal_header *b)
+{
+	return a->base_size == b->base_size && a->base_mtime == b->base_mtime && a->base_mtime_nsec == b->base_mtime_nsec;
+}
+
+/* Whether the document's lines still point into the file that a journal starts from. */
+static int mapping_is_base(struct document *document, const struct journal_header *header)
+{
+	return document->mapping != NULL && (int64_t)document->mapping_key.size == header->base_size
+		&& document->mapping_key.mtime == header->base_mtime
+		&& document->mapping_key.mtime_nsec == header->base_mtime_nsec;
+}
+
+/* Whether a swap file belongs to another editor that is still running. */
+static int owned_by_another(const struct journal_header *header)
+{
+	if (header->pid <= 0 || header->pid == getpid())
+		return 0;
+	return kill(header->pid, 0) == 0 || errno == EPERM;
+}
+
+static int has_text(int type)
+{
+	return type == JOURNAL_INSERT_TEXT || type == JOURNAL_INSERT_LINE || type == JOURNAL_LINE;
+}
+
+static int is_snapshot(int type)
+{
+	return type == JOURNAL_FILE_LINES || type == JOURNAL_LINE;
+}
+
+static void append_record(struct textbuf *buffer, int type, int line, long long x, const char *text, long long length)
+{
+	struct journal_record record;
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.line = line;
+	record.length = length;
+	record.x = x;
+
+	textbuf_append(buffer, (const char *)&record, sizeof(record));
+	if (has_text(type))
+		textbuf_append(buffer, text, length);
+}
+
+static void free_journal(struct journal *journal)
+{
+	free(journal->path);
+	free(journal->written_path);
+	textbuf_free(&journal->pending);
+	textbuf_free(&journal->snapshot);
+	textbuf_free(&journal->writing);
+	textbuf_free(&journal->writing_snapshot);
+	textbuf_free(&journal->build);
+	textbuf_free(&journal->build_edits);
+	free(journal);
+}
+
+static int write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t count = write(fd, data, size);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		data += count;
+		size -= count;
+	}
+	return 1;
+}
+
+static void remove_swap_file(struct journal *journal)
+{
+	if (journal->fd != -1)
+		close(journal->fd);
+	if (journal->written_path != NULL)
+		unlink(journal->written_path);
+	free(journal->written_path);
+	journal->written_path = NULL;
+	journal->fd = -1;
+}
+
+/*
+ * Write a whole new swap file next to the old one and move it into place, so
+ * that there is always a complete swap file to recover from.
+ */
+static int create_swap_file(struct journal *journal, const char *path, struct journal_header *header, int has_snapshot)
+{
+	size_t temp_size = strlen(path) + 8;
+	char *temp_path = malloc(temp_size);
+	snprintf(temp_path, temp_size, "%s.new", path);
+
+	header->has_snapshot = has_snapshot;
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	int written = fd != -1
+		&& write_all(fd, (const char *)header, sizeof(*header))
+		&& write_all(fd, journal->writing_snapshot.buffer, journal->writing_snapshot.length)
+		&& write_all(fd, journal->writing.buffer, journal->writing.length)
+		&& fdatasync(fd) == 0
+		&& rename(temp_path, path) == 0;
+
+	if (!written && fd != -1) {
+		close(fd);
+		unlink(temp_path);
+	}
+	free(temp_path);
+	if (!written)
+		return 0;
+
+	if (journal->fd != -1)
+		close(journal->fd);
+	free(journal->written_path);
+	journal->written_path = strdup(path);
+	journal->fd = fd;
+	return 1;
+}
+
+/*
+ * Write out whatever a journal has waiting. This is called with the lock held,
+ * which is let go of while writing. Returns the next journal in the list.
+ */
+static struct journal *write_journal(struct journal *journal)
+{
+	int restart = journal->restart;
+	int has_snapshot = journal->has_snapshot;
+	if (!restart && !has_snapshot && journal->pending.length == 0)
+		return journal->next;
+
+	/* Take the waiting records, so that more can be added while they are written. */
+	struct journal_header header = journal->header;
+	char *path = strdup(journal->path);
+	struct textbuf swap = journal->writing;
+	journal->writing = journal->pending;
+	journal->pending = swap;
+	swap = journal->writing_snapshot;
+	journal->writing_snapshot = journal->snapshot;
+	journal->snapshot = swap;
+	journal->last_record = -1;
+	journal->restart = 0;
+	journal->has_snapshot = 0;
+	journal->busy = 1;
+	pthread_mutex_unlock(&lock);
+
+	if (restart) {
+		remove_swap_file(journal);
+		journal->failed = 0;
+	}
+
+	if (!journal->failed) {
+		int written = 1;
+		if (has_snapshot || (journal->fd == -1 && journal->writing.length > 0))
+			written = create_swap_file(journal, path, &header, has_snapshot);
+		else if (journal->writing.length > 0)
+			written = write_all(journal->fd, journal->writing.buffer, journal->writing.length) && fdatasync(journal->fd) == 0;
+
+		if (!written) {
+			warning("Failed to write a swap file, so edits to this file can not be recovered");
+			journal->failed = 1;
+		}
+	}
+
+	textbuf_clear(&journal->writing);
+	textbuf_clear(&journal->writing_snapshot);
+	free(path);
+
+	pthread_mutex_lock(&lock);
+	journal->busy = 0;
+	pthread_cond_broadcast(&done_cond);
+	return journal->next;
+}
+
+static void *journal_thread(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		if (!thread_quit && !flush_requested) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += JOURNAL_FLUSH_SECONDS;
+			pthread_cond_timedwait(&cond, &lock, &deadline);
+		}
+
+		/* Everything left is written out once more before the thread stops. */
+		int quit = thread_quit;
+		flush_requested = 0;
+		struct journal *journal = journals;
+		while (journal != NULL)
+			journal = write_journal(journal);
+		if (quit)
+			break;
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void journal_start(void)
+{
+	thread_quit = 0;
+	if (pthread_create(&thread, NULL, journal_thread, NULL) != 0)
+		fatal_error("Failed to start the journal thread\n");
+	thread_running = 1;
+}
+
+void journal_stop(void)
+{
+	if (!thread_running)
+		return;
+
+	pthread_mutex_lock(&lock);
+	thread_quit = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	thread_running = 0;
+}
+
+static struct journal *new_journal(char *path, const struct journal_header *header)
+{
+	struct journal *journal = malloc(sizeof(*journal));
+	if (journal == NULL)
+		fatal_error("Failed to allocate a journal for %s\n", path);
+
+	journal->path = path;
+	journal->header = *header;
+	journal->pending = textbuf_init();
+	journal->last_record = -1;
+	journal->snapshot = textbuf_init();
+	journal->has_snapshot = 0;
+	journal->restart = 0;
+	journal->busy = 0;
+	journal->written_path = NULL;
+	journal->fd = -1;
+	journal->failed = 0;
+	journal->writing = textbuf_init();
+	journal->writing_snapshot = textbuf_init();
+	journal->recorded = 0;
+	journal->snapshot_size = 0;
+	journal->base_is_mapping = 0;
+	journal->building = 0;
+	journal->build_line = 0;
+	journal->build = textbuf_init();
+	journal->run_start = -1;
+	journal->run_end = -1;
+	journal->build_edits = textbuf_init();
+	journal->build_last_record = -1;
+
+	pthread_mutex_lock(&lock);
+	journal->previous = NULL;
+	journal->next = journals;
+	if (journals != NULL)
+		journals->previous = journal;
+	journals = journal;
+	pthread_mutex_unlock(&lock);
+	return journal;
+}
+
+void journal_close(struct journal *journal)
+{
+	if (journal == NULL)
+		return;
+
+	pthread_mutex_lock(&lock);
+	while (journal->busy)
+		pthread_cond_wait(&done_cond, &lock);
+	if (journal->previous != NULL)
+		journal->previous->next = journal->next;
+	else
+		journals = journal->next;
+	if (journal->next != NULL)
+		journal->next->previous = journal->previous;
+	pthread_mutex_unlock(&lock);
+
+	/* A swap file that was recovered from may not have been written over yet. */
+	remove_swap_file(journal);
+	unlink(journal->path);
+	free_journal(journal);
+}
+
+/*
+ * Add to the last record instead of making a new one, if it is of the same
+ * type and carries on from where it ended, so that a run of typing or of
+ * deleting is a single record.
+ */
+static int extend_record(struct textbuf *buffer, long last_record, int type, int line, long long x, const char *text, size_t length)
+{
+	if (last_record < 0)
+		return 0;
+
+	struct journal_record record;
+	memcpy(&record, &buffer->buffer[last_record], sizeof(record));
+	if (record.type != type || record.line != line)
+		return 0;
+
+	if (type == JOURNAL_INSERT_TEXT && x == record.x + record.length) {
+		/* The last record is at the end of the journal, so its text can simply be added to. */
+		textbuf_append(buffer, text, length);
+	} else if (type == JOURNAL_DELETE_TEXT && x == record.x) {
+	} else if (type == JOURNAL_DELETE_TEXT && x + (long long)length == record.x) {
+		record.x = x;
+	} else {
+		return 0;
+	}
+
+	record.length += length;
+	memcpy(&buffer->buffer[last_record], &record, sizeof(record));
+	return 1;
+}
+
+static void add_edit(struct textbuf *buffer, long *last_record, int type, int line, long long x, const char *text, size_t length)
+{
+	if (!extend_record(buffer, *last_record, type, line, x, text, length)) {
+		*last_record = buffer->length;
+		append_record(buffer, type, line, x, text, length);
+	}
+}
+
+/*
+ * Whether an edit is to the lines a snapshot being built has already taken,
+ * which it has to be made again on top of, and the others taken as they are
+ * when it gets to them.
+ */
+static int edit_is_behind_build(struct journal *journal, int type, int line)
+{
+	if (!journal->building || line >= journal->build_line)
+		return 0;
+
+	if (type == JOURNAL_INSERT_LINE)
+		journal->build_line++;
+	else if (type == JOURNAL_DELETE_LINE)
+		journal->build_line--;
+	return 1;
+}
+
+static void record_edit(struct journal *journal, int type, int line, long long x, const char *text, size_t length)
+{
+	if (journal == NULL)
+		return;
+
+	pthread_mutex_lock(&lock);
+	add_edit(&journal->pending, &journal->last_record, type, line, x, text, length);
+	if (journal->pending.length >= JOURNAL_BATCH_SIZE) {
+		flush_requested = 1;
+		pthread_cond_signal(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (edit_is_behind_build(journal, type, line))
+		add_edit(&journal->build_edits, &journal->build_last_record, type, line, x, text, length);
+	journal->recorded += sizeof(struct journal_record) + (has_text(type) ? length : 0);
+}
+
+void journal_record_insert_text(struct journal *journal, int line, int x, const char *text, size_t length)
+{
+	record_edit(journal, JOURNAL_INSERT_TEXT, line, x, text, length);
+}
+
+void journal_record_delete_text(struct journal *journal, int line, int x, size_t length)
+{
+	record_edit(journal, JOURNAL_DELETE_TEXT, line, x, NULL, length);
+}
+
+void journal_record_insert_line(struct journal *journal, int at, const char *text, size_t length)
+{
+	record_edit(journal, JOURNAL_INSERT_LINE, at, 0, text, length);
+}
+
+void journal_record_delete_line(struct journal *journal, int at)
+{
+	record_edit(journal, JOURNAL_DELETE_LINE, at, 0, NULL, 0);
+}
+
+static void start_build(struct journal *journal)
+{
+	journal->building = 1;
+	journal->build_line = 0;
+	textbuf_clear(&journal->build);
+	journal->run_start = -1;
+	textbuf_clear(&journal->build_edits);
+	journal->build_last_record = -1;
+}
+
+static void end_run(struct journal *journal)
+{
+	if (journal->run_start < 0)
+		return;
+	append_record(&journal->build, JOURNAL_FILE_LINES, 0, journal->run_start, NULL, journal->run_end - journal->run_start);
+	journal->run_start = -1;
+}
+
+/*
+ * Describe up to max_lines more lines of the document, or max_bytes of their
+ * text: runs of lines that are still next to each other in the file by where
+ * they are in it, and the others by their text.
+ */
+static void build_step(struct editor_state *editor, int max_lines, size_t max_bytes)
+{
+	struct journal *journal = editor->journal;
+	struct document *document = &editor->document;
+	size_t copied = 0;
+
+	for (int i = 0; i < max_lines && copied < max_bytes && journal->build_line < editor->num_lines; i++) {
+		line_t *line = document_get(document, journal->build_line++);
+
+		if (!journal->base_is_mapping || !line->is_mapped) {
+			end_run(journal);
+			append_record(&journal->build, JOURNAL_LINE, 0, 0, line->chars, line->size);
+			copied += line->size;
+			continue;
+		}
+
+		long long start = line->chars - document->mapping;
+		if (start != journal->run_end)
+			end_run(journal);
+		if (journal->run_start < 0)
+			journal->run_start = start;
+
+		/* Take in the line's ending, which may have carriage returns before the newline. */
+		long long end = start + line->size;
+		while (end < (long long)document->mapping_size && document->mapping[end] == '\r')
+			end++;
+		if (end < (long long)document->mapping_size && document->mapping[end] == '\n')
+			end++;
+		journal->run_end = end;
+	}
+}
+
+/* Hand a snapshot that has taken every line to the thread, in place of what it was to write. */
+static void finish_build(struct journal *journal)
+{
+	end_run(journal);
+	journal->snapshot_size = journal->build.length;
+	journal->recorded = journal->build_edits.length;
+
+	pthread_mutex_lock(&lock);
+	struct textbuf snapshot = journal->snapshot;
+	journal->snapshot = journal->build;
+	journal->has_snapshot = 1;
+	struct textbuf pending = journal->pending;
+	journal->pending = journal->build_edits;
+	journal->last_record = journal->build_last_record;
+	pthread_mutex_unlock(&lock);
+
+	textbuf_free(&snapshot);
+	textbuf_free(&pending);
+	journal->build = textbuf_init();
+	journal->build_edits = textbuf_init();
+	journal->building = 0;
+}
+
+static void compact_journal(struct editor_state *editor)
+{
+	start_build(editor->journal);
+	build_step(editor, INT_MAX, SIZE_MAX);
+	finish_build(editor->journal);
+}
+
+void editor_compact_journal(struct editor_state *editor)
+{
+	struct journal *journal = editor->journal;
+	if (journal == NULL)
+		return;
+
+	if (!journal->building) {
+		if (journal->recorded < JOURNAL_MIN_COMPACT_SIZE || journal->recorded < journal->snapshot_size * 2)
+			return;
+		start_build(journal);
+	}
+
+	build_step(editor, JOURNAL_COMPACT_STEP_LINES, JOURNAL_COMPACT_STEP_BYTES);
+	if (journal->build_line == editor->num_lines)
+		finish_build(journal);
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	char *data = NULL;
+	if (fstat(fd, &st) == 0 && (data = malloc(st.st_size + 1)) != NULL) {
+		size_t done = 0;
+		while (done < (size_t)st.st_size) {
+			ssize_t count = read(fd, &data[done], st.st_size - done);
+			if (count == -1 && errno == EINTR)
+				continue;
+			if (count <= 0)
+				break;
+			done += count;
+		}
+		*size = done;
+	}
+
+	close(fd);
+	return data;
+}
+
+/*
+ * Read the record at an offset, if all of it made it into the swap file
+ * before the editor stopped. Returns its size, or 0 if it is not all there.
+ */
+static size_t read_record(const char *data, size_t size, size_t offset, struct journal_record *record)
+{
+	if (size - offset < sizeof(*record))
+		return 0;
+
+	memcpy(record, &data[offset], sizeof(*record));
+	if (record->type > JOURNAL_LINE || record->length < 0)
+		return 0;
+	if (record->type != JOURNAL_FILE_LINES && record->length > INT_MAX)
+		return 0;
+
+	size_t text = has_text(record->type) ? record->length : 0;
+	if (size - offset - sizeof(*record) < text)
+		return 0;
+	return sizeof(*record) + text;
+}
+
+/* Make a new document from the lines of a snapshot, keeping the mapping of the file. */
+static void rebuild_document(struct editor_state *editor, const char *data, size_t offset, size_t end)
+{
+	struct document *old = &editor->document;
+	struct document document;
+	document_init(&document);
+	document.mapping = old->mapping;
+	document.mapping_size = old->mapping_size;
+	document.mapping_fd = old->mapping_fd;
+	document.mapping_key = old->mapping_key;
+	old->mapping = NULL;
+	old->mapping_fd = -1;
+	document_free(old);
+
+	struct journal_record record;
+	size_t record_size;
+	for (; offset < end; offset += record_size) {
+		record_size = read_record(data, end, offset, &record);
+		if (record.type == JOURNAL_FILE_LINES) {
+			if (record.length > 0)
+				file_split_lines(&document, document.mapping + record.x, record.length);
+		} else {
+			line_t *line = document_insert(&document, document_num_lines(&document));
+			line_init_mapped(line, (char *)&data[offset + sizeof(record)], record.length);
+			line_materialize(&document, line);
+		}
+	}
+
+	editor->document = document;
+	editor->num_lines = document_num_lines(&editor->document);
+	editor_invalidate_syntax(editor, 0);
+	editor_damage_all(editor);
+}
+
+static void replay_edit(struct editor_state *editor, struct journal_record *record, const char *text)
+{
+	int in_document = record->line >= 0 && record->line < editor->num_lines;
+	int x = record->x >= 0 && record->x <= INT_MAX ? record->x : -1;
+	line_t *line = in_document ? document_get(&editor->document, record->line) : NULL;
+
+	switch (record->type) {
+	case JOURNAL_INSERT_TEXT:
+		if (line != NULL)
+			line_insert_string(editor, line, x, text, record->length);
+		break;
+	case JOURNAL_DELETE_TEXT:
+		if (line != NULL)
+			line_delete_string(editor, line, x, record->length);
+		break;
+	case JOURNAL_INSERT_LINE:
+		editor_insert_line(editor, record->line, (char *)text, record->length);
+		break;
+	case JOURNAL_DELETE_LINE:
+		editor_delete_line(editor, record->line);
+		break;
+	}
+}
+
+/*
+ * Make the edits in a swap file again, after any snapshot it starts with.
+ * Returns how many there were, counting the snapshot as one, or -1 if the
+ * snapshot does not fit the file.
+ */
+static int recover(struct editor_state *editor, const char *data, size_t size, const struct journal_header *header)
+{
+	struct journal_record record;
+	size_t offset = sizeof(*header);
+	size_t record_size;
+	int edits = 0;
+
+	if (header->has_snapshot) {
+		/* Check all of the snapshot before throwing away the lines that were loaded. */
+		int from_mapping = mapping_is_base(&editor->document, header);
+		size_t end = offset;
+		while ((record_size = read_record(data, size, end, &record)) != 0 && is_snapshot(record.type)) {
+			if (record.type == JOURNAL_FILE_LINES && (!from_mapping || record.x < 0
+					|| (size_t)record.x > editor->document.mapping_size
+					|| (size_t)record.length > editor->document.mapping_size - record.x))
+				return -1;
+			end += record_size;
+		}
+
+		rebuild_document(editor, data, offset, end);
+		offset = end;
+		edits++;
+	}
+
+	while ((record_size = read_record(data, size, offset, &record)) != 0 && !is_snapshot(record.type)) {
+		replay_edit(editor, &record, &data[offset + sizeof(record)]);
+		offset += record_size;
+		edits++;
+	}
+	return edits;
+}
+
+/* Move a swap file that can not be recovered out of the way, rather than writing over it. */
+static void set_aside(struct editor_state *editor, const char *path)
+{
+	size_t size = strlen(path) + 8;
+	char *old_path = malloc(size);
+	snprintf(old_path, size, "%s.old", path);
+	if (rename(path, old_path) == 0)
+		editor_set_status_message(editor, "Kept a swap file for another version of this file as %s", old_path);
+	free(old_path);
+}
+
+void editor_open_journal(struct editor_state *editor)
+{
+	if (!thread_running || editor->filename == NULL)
+		return;
+
+	struct journal_header base;
+	identify_base(&base, editor->filename);
+	char *path = swap_path(editor->filename);
+
+	size_t size = 0;
+	char *data = read_file(path, &size);
+	int recovered = 0;
+	if (data != NULL) {
+		struct journal_header header;
+		int valid = size >= sizeof(header);
+		if (valid)
+			memcpy(&header, data, sizeof(header));
+		valid = valid && header.magic == JOURNAL_MAGIC;
+
+		if (valid && owned_by_another(&header)) {
+			editor_set_status_message(editor, "This file is open in another editor (%ld), so it is not journaled", (long)header.pid);
+			free(data);
+			free(path);
+			return;
+		}
+
+		recovered = valid && same_base(&header, &base) ? recover(editor, data, size, &header) : -1;
+		if (recovered < 0)
+			set_aside(editor, path);
+		free(data);
+	}
+
+	struct journal *journal = new_journal(path, &base);
+	journal->base_is_mapping = mapping_is_base(&editor->document, &base);
+	journal->snapshot_size = journal->base_is_mapping || base.base_size < 0 ? 0 : base.base_size;
+	editor->journal = journal;
+
+	if (recovered > 0) {
+		/* The recovered edits are undone together, and written out again as a snapshot. */
+		undo_start_change(&editor->undo);
+		compact_journal(editor);
+		editor->dirty = 1;
+		editor_set_status_message(editor, "Recovered %d unsaved edits from %s", recovered, path);
+	}
+}
+
+void editor_journal_saved(struct editor_state *editor)
+{
+	if (!thread_running || editor->filename == NULL)
+		return;
+	if (editor->journal == NULL) {
+		editor_open_journal(editor);
+		return;
+	}
+
+	struct journal *journal = editor->journal;
+	struct journal_header base;
+	identify_base(&base, editor->filename);
+	char *path = swap_path(editor->filename);
+
+	pthread_mutex_lock(&lock);
+	free(journal->path);
+	journal->path = path;
+	journal->header = base;
+	textbuf_clear(&journal->pending);
+	journal->last_record = -1;
+	textbuf_clear(&journal->snapshot);
+	journal->has_snapshot = 0;
+	journal->restart = 1;
+	pthread_mutex_unlock(&lock);
+
+	/* The lines still point into the file as it was before, so a snapshot has to copy all of them. */
+	journal->base_is_mapping = 0;
+	journal->building = 0;
+	journal->snapshot_size = base.base_size > 0 ? base.base_size : 0;
+	journal->recorded = 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * journal.h: Recovering unsaved edits after a crash.
+ *
+ * Every edit made to a file is added to a journal in memory, which a thread
+ * of its own appends to a swap file next to the file about once a second, so
+ * typing never waits for the disk. Once the journal has grown large, it is
+ * rewritten as a snapshot of the lines, which refers to runs of lines that are
+ * still as they were in the file instead of copying them. Saving the file
+ * starts a new journal, and closing it removes the swap file. If the editor
+ * exits without closing the file, the edits in its swap file are made again
+ * when the file is next opened.
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stddef.h>
+
+/* Swap files are named after the file, starting with a dot and ending in this. */
+#define JOURNAL_SWAP_SUFFIX ".glypher-swap"
+
+/* How often edits are written out, unless this much is waiting first. */
+#define JOURNAL_FLUSH_SECONDS 1
+#define JOURNAL_BATCH_SIZE (1 << 20)
+
+/* The journal is not compacted until it holds this much, or twice as much as its last snapshot. */
+#define JOURNAL_MIN_COMPACT_SIZE (1 << 20)
+/* A snapshot is built over several frames, taking at most this many lines, or this much of their text, in each. */
+#define JOURNAL_COMPACT_STEP_LINES (64 * 1024)
+#define JOURNAL_COMPACT_STEP_BYTES (1 << 20)
+
+struct editor_state;
+struct journal;
+
+/* Without the thread, nothing is journaled. */
+void journal_start(void);
+void journal_stop(void);
+
+/* Make again any edits left in the swap file of a file that was just opened, and start journaling it. */
+void editor_open_journal(struct editor_state *);
+/* Start a new journal from the file that was just saved. */
+void editor_journal_saved(struct editor_state *);
+/* Build a snapshot of the document a step at a time, once the journal has grown enough since the last. */
+void editor_compact_journal(struct editor_state *);
+/* Stop journaling a file that was closed, and remove its swap file. */
+void journal_close(struct journal *);
+
+void journal_record_insert_text(struct journal *, int line, int x, const char *text, size_t length);
+void journal_record_delete_text(struct journal *, int line, int x, size_t length);
+void journal_record_insert_line(struct journal *, int at, const char *text, size_t length);
+void journal_record_delete_line(struct journal *, int at);
+
+#endif
@@ -1,65 +1,222 @@
 #include "line.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "document.h"
+#include "editor.h"
+#include "journal.h"
+#include "pool.h"
+#include "scan.h"
+#include "search.h"
 #include "syntax.h"
+#include "undo.h"
 
-int row_x_to_display_x(line_t *line, int x)
+/* Find how many of the line's tabs come before the given position. */
+static int tabs_before(line_t *line, int x)
 {
-	int display_x = 0;
-	int j;
+	int low = 0, high = line->num_tabs;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (line->tabs[middle].x < x)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
 
-	for (j = 0; j < x; j++)	{
-		if (line->chars[j] == '\t')
-			display_x += (TAB_WIDTH - 1) - (display_x % TAB_WIDTH);
-		display_x++;
+int row_x_to_display_x(line_t *line, int x)
+{
+	/* Lines that have not been drawn yet have no tab index. */
+	if (line->render == NULL) {
+		int display_x = 0;
+		for (int j = 0; j < x; j++) {
+			if (line->chars[j] == '\t')
+				display_x += (TAB_WIDTH - 1) - (display_x % TAB_WIDTH);
+			display_x++;
+		}
+		return display_x;
 	}
 
-	return display_x;
+	int tabs = tabs_before(line, x);
+	if (tabs == 0)
+		return x;
+
+	struct tab_stop *tab = &line->tabs[tabs - 1];
+	return tab->display_x + (x - tab->x - 1);
 }
 
 int row_display_x_to_x(line_t *line, int display_x)
 {
-	int current_display_x = 0;
-	int result_x;
+	if (line->render == NULL) {
+		int current_display_x = 0;
+		int x;
+		for (x = 0; x < line->size; x++) {
+			if (line->chars[x] == '\t')
+				current_display_x += (TAB_WIDTH - 1) - (current_display_x % TAB_WIDTH);
+			current_display_x++;
 
-	for (result_x = 0; result_x < line->size; result_x++) {
-		if (line->chars[result_x] == '\t')
-			result_x += (TAB_WIDTH - 1) - (current_display_x % TAB_WIDTH);
-		result_x++;
+			if (current_display_x > display_x)
+				return x;
+		}
+		return x;
+	}
 
-		if (current_display_x > display_x)
-			return result_x;
+	/* Find the last tab that ends at or before the display column. */
+	int low = 0, high = line->num_tabs;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (line->tabs[middle].display_x <= display_x)
+			low = middle + 1;
+		else
+			high = middle;
 	}
-	return result_x;
+
+	int x = display_x;
+	if (low > 0)
+		x = line->tabs[low - 1].x + 1 + (display_x - line->tabs[low - 1].display_x);
+
+	/* Columns in the middle of a tab belong to the tab. */
+	if (low < line->num_tabs && x > line->tabs[low].x)
+		x = line->tabs[low].x;
+	if (x > line->size)
+		x = line->size;
+	return x;
 }
 
-void editor_update_line(struct editor_state *editor, line_t *line)
+/* Give a line's render block back, unless its render is its text. */
+static void release_render(struct pool *pool, line_t *line)
 {
-	int tabs = 0;
-	int j;
-	for (j = 0; j < line->size; j++)
-		if (line->chars[j] == '\t') tabs++;
+	if (line->render_capacity > 0)
+		pool_release(pool, line->render, line->render_capacity);
+	line->render = NULL;
+	line->render_capacity = 0;
+}
+
+/*
+ * Resize an array in the pool without keeping its contents. Blocks from the
+ * pool are rounded up, so it only moves when its size changes a lot.
+ */
+static void *resize_array(struct pool *pool, void *block, size_t old_size, size_t size)
+{
+	if (size == 0) {
+		pool_release(pool, block, old_size);
+		return NULL;
+	}
+	return pool_resize(pool, block, old_size, size, 0);
+}
+
+/* Rebuild the render data and tab index of a line, and have it highlighted again. */
+static int update_render(struct editor_state *editor, line_t *line)
+{
+	struct pool *pool = &editor->document.pool;
+	int tabs = scan_count(line->chars, line->size, '\t');
+
+	line->tabs = resize_array(pool, line->tabs, sizeof(struct tab_stop) * line->num_tabs, sizeof(struct tab_stop) * tabs);
+	line->num_tabs = tabs;
+
+	if (tabs == 0) {
+		/* Lines without tabs are drawn straight from their text. */
+		release_render(pool, line);
+		line->render = line->chars;
+		line->render_size = line->size;
+	} else {
+		/*
+		 * Collect the positions at the start of the tab index, then spread
+		 * them out from the back so none are overwritten before being moved.
+		 */
+		int *positions = (int *)line->tabs;
+		scan_positions(line->chars, line->size, '\t', positions);
+		for (int k = tabs - 1; k >= 0; k--)
+			line->tabs[k].x = positions[k];
+
+		/* The render block is kept until the line outgrows it. */
+		int needed = line->size + tabs * (TAB_WIDTH - 1) + 1;
+		if (needed > line->render_capacity) {
+			size_t capacity = needed > line->render_capacity * 2 ? needed : line->render_capacity * 2;
+			release_render(pool, line);
+			line->render = pool_alloc(pool, capacity);
+			line->render_capacity = pool_block_size(capacity);
+		}
 
-	free(line->render);
-	line->render = malloc(line->size + tabs * (TAB_WIDTH - 1) + 1);
+		/* Copy the text between tabs in one go, and expand each tab. */
+		int index = 0;
+		int j = 0;
+		for (int k = 0; k < tabs; k++) {
+			int tab = line->tabs[k].x;
+			memcpy(&line->render[index], &line->chars[j], tab - j);
+			index += tab - j;
 
-	int index = 0;
-	for (j = 0; j < line->size; j++)	{
-		if (line->chars[j] == '\t') {
 			line->render[index++] = ' ';
 			while (index % TAB_WIDTH != 0) line->render[index++] = ' ';
-		} else {
-			line->render[index++] = line->chars[j];
+
+			line->tabs[k].display_x = index;
+			j = tab + 1;
 		}
+		memcpy(&line->render[index], &line->chars[j], line->size - j);
+		index += line->size - j;
+
+		line->render[index] = '\0';
+		line->render_size = index;
 	}
-	
-	line->render[index] = '\0';
-	line->render_size = index;
+	line->version++;
 
+	int at = document_index_of(&editor->document, line);
+	editor_damage_lines(editor, at, at + 1);
 	editor_update_syntax(editor, line);
+	return at;
+}
+
+/*
+ * Turn a byte of highlighting for each character into runs, leaving out the
+ * plain text at the end. There is room for a run per character at most.
+ */
+int line_encode_spans(const unsigned char *highlight, int length, struct highlight_span *spans)
+{
+	int num_spans = 0;
+	int i = 0;
+	while (i < length) {
+		int start = i;
+		while (i < length && highlight[i] == highlight[start] && i - start < HIGHLIGHT_SPAN_MAX_LENGTH)
+			i++;
+
+		spans[num_spans].length = i - start;
+		spans[num_spans].type = highlight[start];
+		num_spans++;
+	}
+
+	while (num_spans > 0 && spans[num_spans - 1].type == HIGHLIGHT_NORMAL)
+		num_spans--;
+	return num_spans;
+}
+
+void line_set_spans(struct document *document, line_t *line, const struct highlight_span *spans, int num_spans)
+{
+	size_t size = sizeof(struct highlight_span) * num_spans;
+	line->spans = resize_array(&document->pool, line->spans, sizeof(struct highlight_span) * line->num_spans, size);
+	line->num_spans = num_spans;
+	if (num_spans > 0)
+		memcpy(line->spans, spans, size);
+}
+
+/* Bring everything that depends on a line's text up to date after it has changed. */
+void editor_update_line(struct editor_state *editor, line_t *line)
+{
+	int at = update_render(editor, line);
+	editor_search_update_line(editor, at);
+}
+
+/*
+ * Build the render and highlight data of a line if it has never been drawn.
+ * Its text is the same as it was, so it does not need to be searched again.
+ */
+void editor_render_line(struct editor_state *editor, line_t *line)
+{
+	if (line->render == NULL)
+		update_render(editor, line);
 }
 
 void editor_insert_line(struct editor_state *editor, int at, char* string, size_t length)
@@ -67,34 +224,91 @@ void editor_insert_line(struct editor_state *editor, int at, char* string, size_
 	if (at < 0 || at > editor->num_lines)
 		return;
 
-	editor->lines = realloc(editor->lines, sizeof(line_t) * (editor->num_lines + 1));
-	memmove(&editor->lines[at + 1], &editor->lines[at], sizeof(line_t) * (editor->num_lines - at));
-
-	for (int j = at + 1; j <= editor->num_lines; j++)
-		editor->lines[at].index++;
-		
-	editor->lines[at].index = at;
-
-	editor->lines[at].size = length;
-	editor->lines[at].chars = malloc(length + 1);
-	memcpy(editor->lines[at].chars, string, length);
-	editor->lines[at].chars[length] = '\0';
-
-	editor->lines[at].render_size = 0;
-	editor->lines[at].render = NULL;
-	editor->lines[at].highlight = NULL;
-	editor->lines[at].highlight_open_comment = 0;
-	editor_update_line(editor, &editor->lines[at]);
-	
+	line_t *line = document_insert(&editor->document, at);
 	editor->num_lines++;
+
+	/* Start out pointing at the string, then take a copy of it. */
+	line_init_mapped(line, string, length);
+	line_materialize(&editor->document, line);
+	undo_record_insert_line(&editor->undo, at, line->chars, line->size);
+	journal_record_insert_line(editor->journal, at, line->chars, line->size);
+
+	editor_invalidate_syntax(editor, at);
+	editor_damage_lines(editor, at, INT_MAX);
+	editor_search_insert_line(editor, at);
+	editor_update_line(editor, line);
+
 	editor->dirty = 1;
 }
 
-void free_line(line_t *line)
+/*
+ * Set up a line that points into the document's file mapping. Its render and
+ * highlight data are left to be built once the line is drawn.
+ */
+void line_init_mapped(line_t *line, char *chars, size_t length)
 {
-	free(line->render);
-	free(line->chars);
-	free(line->highlight);
+	line->size = length;
+	line->chars = chars;
+	line->is_mapped = 1;
+	line->capacity = 0;
+	line->render_size = 0;
+	line->render_capacity = 0;
+	line->render = NULL;
+	line->num_tabs = 0;
+	line->num_spans = 0;
+	line->tabs = NULL;
+	line->spans = NULL;
+	line->highlight_start_comment = 0;
+	line->highlight_open_comment = 0;
+	line->highlight_dirty = 1;
+	line->version = 0;
+}
+
+/* Give a line its own copy of its text, so that it can be edited. */
+void line_materialize(struct document *document, line_t *line)
+{
+	if (!line->is_mapped)
+		return;
+
+	char *chars = pool_alloc(&document->pool, line->size + 1);
+	memcpy(chars, line->chars, line->size);
+	chars[line->size] = '\0';
+
+	if (line->render == line->chars)
+		line->render = chars;
+	line->chars = chars;
+	line->capacity = pool_block_size(line->size + 1);
+	line->is_mapped = 0;
+}
+
+/* Make room for a line's text to grow to some size, doubling its block when it runs out. */
+static void reserve_chars(struct document *document, line_t *line, size_t size)
+{
+	line_materialize(document, line);
+	if (size + 1 <= (size_t)line->capacity)
+		return;
+
+	size_t capacity = size + 1 > (size_t)line->capacity * 2 ? size + 1 : (size_t)line->capacity * 2;
+	char *chars = pool_resize(&document->pool, line->chars, line->capacity, capacity, line->size + 1);
+	if (line->render == line->chars)
+		line->render = chars;
+	line->chars = chars;
+	line->capacity = pool_block_size(capacity);
+}
+
+/*
+ * Give a line's memory back to the document's pool. Lines do not need to be
+ * freed when the whole document is, as the pool is released in one go.
+ */
+void free_line(struct document *document, line_t *line)
+{
+	struct pool *pool = &document->pool;
+
+	release_render(pool, line);
+	pool_release(pool, line->tabs, sizeof(struct tab_stop) * line->num_tabs);
+	pool_release(pool, line->spans, sizeof(struct highlight_span) * line->num_spans);
+	if (!line->is_mapped)
+		pool_release(pool, line->chars, line->capacity);
 }
 
 void editor_delete_line(struct editor_state *editor, int at)
@@ -102,49 +316,111 @@ void editor_delete_line(struct editor_state *editor, int at)
 	if (at < 0 || at >= editor->num_lines)
 		return;
 
-	free_line(&editor->lines[at]);
-	memmove(&editor->lines[at], &editor->lines[at + 1], sizeof(line_t) * (editor->num_lines - at - 1));
-
-	for (int j = at; j < editor->num_lines; j++)
-		editor->lines[j].index--;
+	line_t *line = document_get(&editor->document, at);
+	undo_record_delete_line(&editor->undo, at, line->chars, line->size);
+	journal_record_delete_line(editor->journal, at);
+	free_line(&editor->document, line);
+	document_remove(&editor->document, at);
+	editor_invalidate_syntax(editor, at);
+	editor_damage_lines(editor, at, INT_MAX);
+	editor_search_delete_line(editor, at);
 
 	editor->num_lines--;
 	editor->dirty = 1;
 }
 
-void line_insert_char(struct editor_state *editor, line_t *line, int at, int c)
+void line_insert_string(struct editor_state *editor, line_t *line, int at, const char *string, size_t length)
 {
 	if (at < 0 || at > line->size)
 		at = line->size;
 
-	line->chars = realloc(line->chars, line->size + 2);
-	memmove(&line->chars[at + 1], &line->chars[at], line->size - at + 1);
-	line->size++;
-	line->chars[at] = c;
+	int index = document_index_of(&editor->document, line);
+	undo_record_insert_text(&editor->undo, index, at, string, length);
+	journal_record_insert_text(editor->journal, index, at, string, length);
 
-	editor_update_line(editor, line);
+	reserve_chars(&editor->document, line, line->size + length);
+	memmove(&line->chars[at + length], &line->chars[at], line->size - at + 1);
+	memcpy(&line->chars[at], string, length);
+	line->size += length;
 
+	editor_update_line(editor, line);
 	editor->dirty = 1;
 }
 
+void line_insert_char(struct editor_state *editor, line_t *line, int at, int c)
+{
+	char letter = c;
+	line_insert_string(editor, line, at, &letter, 1);
+}
+
 void line_append_string(struct editor_state *editor, line_t *line, char* string, size_t length)
 {
-	line->chars = realloc(line->chars, line->size + length + 1);
-	memcpy(&line->chars[line->size], string, length);
-	line->size += length;
-	line->chars[line->size] = '\0';
+	line_insert_string(editor, line, line->size, string, length);
+}
+
+/* Replace the whole text of a line with a copy of a string. */
+void line_set_string(struct editor_state *editor, line_t *line, const char *string, size_t length)
+{
+	/* Only the part between what the old and new text have in common at each end is recorded. */
+	size_t prefix = 0;
+	while (prefix < length && prefix < (size_t)line->size && string[prefix] == line->chars[prefix])
+		prefix++;
+	size_t suffix = 0;
+	while (suffix < length - prefix && suffix < line->size - prefix
+			&& string[length - suffix - 1] == line->chars[line->size - suffix - 1])
+		suffix++;
+
+	int at = document_index_of(&editor->document, line);
+	if (prefix + suffix < (size_t)line->size) {
+		undo_record_delete_text(&editor->undo, at, prefix, &line->chars[prefix], line->size - prefix - suffix);
+		journal_record_delete_text(editor->journal, at, prefix, line->size - prefix - suffix);
+	}
+	if (prefix + suffix < length) {
+		undo_record_insert_text(&editor->undo, at, prefix, &string[prefix], length - prefix - suffix);
+		journal_record_insert_text(editor->journal, at, prefix, &string[prefix], length - prefix - suffix);
+	}
+
+	if (line->is_mapped || length + 1 > (size_t)line->capacity) {
+		struct pool *pool = &editor->document.pool;
+		if (!line->is_mapped)
+			pool_release(pool, line->chars, line->capacity);
+		line->chars = pool_alloc(pool, length + 1);
+		line->capacity = pool_block_size(length + 1);
+		line->is_mapped = 0;
+	}
+	memmove(line->chars, string, length);
+	line->chars[length] = '\0';
+	line->size = length;
 
 	editor_update_line(editor, line);
 	editor->dirty = 1;
 }
 
-void line_delete_char(struct editor_state *editor, line_t *line, int at)
+void line_delete_string(struct editor_state *editor, line_t *line, int at, size_t length)
 {
-	if (at < 0 || at >= line->size)
+	if (at < 0 || at + length > (size_t)line->size)
 		return;
 
-	memmove(&line->chars[at], &line->chars[at + 1], line->size - at);
-	line->size--;
+	int index = document_index_of(&editor->document, line);
+	undo_record_delete_text(&editor->undo, index, at, &line->chars[at], length);
+	journal_record_delete_text(editor->journal, index, at, length);
+
+	line_materialize(&editor->document, line);
+	memmove(&line->chars[at], &line->chars[at + length], line->size - at - length + 1);
+	line->size -= length;
 	editor_update_line(editor, line);
 	editor->dirty = 1;
 }
+
+void line_delete_char(struct editor_state *editor, line_t *line, int at)
+{
+	line_delete_string(editor, line, at, 1);
+}
+
+void line_truncate(struct editor_state *editor, line_t *line, int at)
+{
+	if (at < 0 || at >= line->size)
+		return;
+
+	line_delete_string(editor, line, at, line->size - at);
+}
@@ -5,29 +5,79 @@
 
 #define TAB_WIDTH 4
 
+/* Where a tab is in a line, and the display column just after it. */
+struct tab_stop {
+	int x;
+	int display_x;
+};
+
+/*
+ * A run of characters in a line's render text that are highlighted the same
+ * way. The characters after the last run are not highlighted.
+ */
+struct highlight_span {
+	unsigned int length : 24;
+	unsigned int type : 8;
+};
+
+#define HIGHLIGHT_SPAN_MAX_LENGTH ((1 << 24) - 1)
+
 typedef struct {
-	int index;
 	int size;
+	/* The size of the block holding chars, once the line has its own copy. */
+	int capacity;
 	char* chars;
 	int render_size;
+	/* The size of the block holding render, if it is not the same as chars. */
+	int render_capacity;
+	/*
+	 * This is NULL until the line needs to be drawn. Lines without tabs are
+	 * drawn as they are, so their render is chars itself.
+	 */
 	char* render;
-	unsigned char* highlight;
-	int highlight_open_comment;
+	/* The tabs in the line, built along with the render data. */
+	int num_tabs;
+	int num_spans;
+	struct tab_stop* tabs;
+	struct highlight_span* spans;
+	/* Changes whenever the render data is rebuilt. */
+	unsigned int version;
+	/*
+	 * Lines of a file that was opened with a memory mapping point into that
+	 * mapping until they are edited, and are not NUL terminated until then.
+	 */
+	unsigned char is_mapped;
+	/* Whether the line starts and ends inside a multi-line comment. */
+	unsigned char highlight_start_comment;
+	unsigned char highlight_open_comment;
+	/* Set when the text has changed since the line was last highlighted. */
+	unsigned char highlight_dirty;
 } line_t;
 
 struct editor_state;
+struct document;
 
+int line_encode_spans(const unsigned char *highlight, int length, struct highlight_span *spans);
+void line_set_spans(struct document*, line_t*, const struct highlight_span *spans, int num_spans);
 int row_x_to_display_x(line_t*, int x);
 int row_display_x_to_x(line_t*, int display_x);
 
 void editor_update_line(struct editor_state*, line_t*);
+void editor_render_line(struct editor_state*, line_t*);
 void editor_insert_line(struct editor_state*, int at, char *string, size_t length);
+void line_init_mapped(line_t *, char *chars, size_t length);
 void editor_delete_line(struct editor_state*, int at);
 
+void line_insert_string(struct editor_state*, line_t*, int at, const char* string, size_t length);
 void line_insert_char(struct editor_state*, line_t*, int at, int c);
 void line_append_string(struct editor_state*, line_t*, char* string, size_t length);
+void line_set_string(struct editor_state*, line_t*, const char* string, size_t length);
+void line_delete_string(struct editor_state*, line_t*, int at, size_t length);
 void line_delete_char(struct editor_state*, line_t*, int at);
+void line_truncate(struct editor_state*, line_t*, int at);
+
+void line_materialize(struct document*, line_t*);
 
-void free_line(line_t*);
+void free_line(struct document*, line_t*);
 
 #endif
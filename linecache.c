@@ -0,0 +1,264 @@
+/* For realpath */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "linecache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "cache.h"
+#include "document.h"
+#include "error.h"
+#include "parallel.h"
+#include "syntax.h"
+
+#define LINECACHE_MAGIC 0x31636c67
+#define SYNTAX_NAME_SIZE 16
+
+/* Files are told apart by hashing this many blocks spread through them, rather than all of their text. */
+#define HASH_BLOCKS 64
+#define HASH_BLOCK_SIZE 4096
+
+/* Lines are filled in from the cache on several threads, in chunks of at least this many. */
+#define FILL_MIN_CHUNK_LINES (256 * 1024)
+
+/*
+ * The header is followed by where each line starts in the file, then the size
+ * of each line, then a bit for each checkpoint that is set if that line ends
+ * inside a multi-line comment.
+ */
+struct linecache_header {
+	uint32_t magic;
+	int32_t num_lines;
+	int32_t num_checkpoints;
+	uint32_t padding;
+	struct linecache_key key;
+	/* The syntax the checkpoints were highlighted with, or empty for none. */
+	char syntax[SYNTAX_NAME_SIZE];
+};
+
+struct fill_chunk {
+	char *mapping;
+	const uint64_t *starts;
+	const int32_t *sizes;
+	const unsigned char *checkpoints;
+	int num_checkpoints;
+	line_t *lines;
+	int first, end;
+};
+
+static uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+void linecache_identify(struct linecache_key *key, const char *mapping, const struct stat *st)
+{
+	size_t size = st->st_size;
+	key->size = size;
+	key->mtime = st->st_mtim.tv_sec;
+	key->mtime_nsec = st->st_mtim.tv_nsec;
+	key->hash = 0xcbf29ce484222325ULL;
+
+	if (size <= (size_t)HASH_BLOCKS * HASH_BLOCK_SIZE) {
+		key->hash = hash_bytes(key->hash, mapping, size);
+		return;
+	}
+	for (int i = 0; i < HASH_BLOCKS; i++) {
+		size_t offset = (size - HASH_BLOCK_SIZE) / (HASH_BLOCKS - 1) * i;
+		key->hash = hash_bytes(key->hash, &mapping[offset], HASH_BLOCK_SIZE);
+	}
+}
+
+/* Cache files are named after the full path, so that a file is found from any directory. */
+static char *cache_file(const char *filename)
+{
+	char *full_path = realpath(filename, NULL);
+	char *path = cache_path("lines", full_path ? full_path : filename);
+	free(full_path);
+	return path;
+}
+
+static size_t body_size(int num_lines, int num_checkpoints)
+{
+	return (size_t)num_lines * (sizeof(uint64_t) + sizeof(int32_t)) + (num_checkpoints + 7) / 8;
+}
+
+static int header_matches(const struct linecache_header *header, size_t size, const struct linecache_key *key)
+{
+	return size >= sizeof(*header)
+		&& header->magic == LINECACHE_MAGIC
+		&& header->key.size == key->size && header->key.hash == key->hash
+		&& header->key.mtime == key->mtime && header->key.mtime_nsec == key->mtime_nsec
+		&& header->num_lines > 0
+		&& header->num_checkpoints >= 0 && header->num_checkpoints <= header->num_lines
+		&& size == sizeof(*header) + body_size(header->num_lines, header->num_checkpoints);
+}
+
+/* A damaged cache file must not point lines outside of the file. */
+static int lines_fit(const uint64_t *starts, const int32_t *sizes, int num_lines, size_t file_size)
+{
+	for (int i = 0; i < num_lines; i++) {
+		if (sizes[i] < 0 || starts[i] > file_size || file_size - starts[i] < (uint64_t)sizes[i])
+			return 0;
+	}
+	return 1;
+}
+
+static int checkpoint(const unsigned char *checkpoints, int index)
+{
+	return (checkpoints[index / 8] >> (index % 8)) & 1;
+}
+
+static void *fill_chunk(void *arg)
+{
+	struct fill_chunk *chunk = arg;
+	int in_comment = chunk->first > 0 && chunk->first <= chunk->num_checkpoints
+		&& checkpoint(chunk->checkpoints, chunk->first - 1);
+	int i;
+
+	/* The lines up to the last checkpoint are only highlighted again once they are drawn. */
+	for (i = chunk->first; i < chunk->end && i < chunk->num_checkpoints; i++) {
+		line_t *line = &chunk->lines[i];
+		line_init_mapped(line, chunk->mapping + chunk->starts[i], chunk->sizes[i]);
+
+		line->highlight_start_comment = in_comment;
+		in_comment = checkpoint(chunk->checkpoints, i);
+		line->highlight_open_comment = in_comment;
+		line->highlight_dirty = 0;
+	}
+	for (; i < chunk->end; i++)
+		line_init_mapped(&chunk->lines[i], chunk->mapping + chunk->starts[i], chunk->sizes[i]);
+
+	return NULL;
+}
+
+static void fill_lines(struct document *document, const struct linecache_header *header, struct editor_syntax *syntax)
+{
+	int num_lines = header->num_lines;
+	const uint64_t *starts = (const uint64_t *)(header + 1);
+	const int32_t *sizes = (const int32_t *)(starts + num_lines);
+
+	/* Checkpoints from another syntax are no use. */
+	int num_checkpoints = header->num_checkpoints;
+	if (strncmp(header->syntax, syntax ? syntax->filetype : "", SYNTAX_NAME_SIZE) != 0)
+		num_checkpoints = 0;
+
+	struct fill_chunk chunks[PARALLEL_MAX_TASKS];
+	int num_chunks = parallel_num_tasks(num_lines, FILL_MIN_CHUNK_LINES);
+	line_t *lines = document_append(document, num_lines);
+
+	for (int k = 0; k < num_chunks; k++) {
+		chunks[k].mapping = document->mapping;
+		chunks[k].starts = starts;
+		chunks[k].sizes = sizes;
+		chunks[k].checkpoints = (const unsigned char *)(sizes + num_lines);
+		chunks[k].num_checkpoints = num_checkpoints;
+		chunks[k].lines = lines;
+		chunks[k].first = (long)num_lines * k / num_chunks;
+		chunks[k].end = (long)num_lines * (k + 1) / num_chunks;
+	}
+	parallel_run(chunks, sizeof(*chunks), num_chunks, fill_chunk);
+
+	document->cached_checkpoints = num_checkpoints;
+}
+
+int linecache_load(struct document *document, const char *filename, struct editor_syntax *syntax)
+{
+	if (document->mapping == NULL || document_num_lines(document) != 0)
+		return 0;
+
+	char *path = cache_file(filename);
+	if (path == NULL)
+		return 0;
+
+	size_t size;
+	struct linecache_header *header = cache_map(path, &size);
+	free(path);
+	if (header == NULL)
+		return 0;
+
+	int loaded = 0;
+	if (header_matches(header, size, &document->mapping_key)) {
+		const uint64_t *starts = (const uint64_t *)(header + 1);
+		const int32_t *sizes = (const int32_t *)(starts + header->num_lines);
+		if (lines_fit(starts, sizes, header->num_lines, document->mapping_size)) {
+			fill_lines(document, header, syntax);
+			loaded = 1;
+		}
+	}
+
+	cache_unmap(header, size);
+	return loaded;
+}
+
+void linecache_store(struct document *document, const char *filename, struct editor_syntax *syntax, int num_checkpoints)
+{
+	int num_lines = document_num_lines(document);
+	if (filename == NULL || document->mapping == NULL || num_lines == 0
+			|| document->generation != document->mapping_generation)
+		return;
+
+	if (num_checkpoints > num_lines)
+		num_checkpoints = num_lines;
+	/* There is nothing to add to what the cache already holds. */
+	if (num_checkpoints <= document->cached_checkpoints)
+		return;
+
+	char *path = cache_file(filename);
+	if (path == NULL)
+		return;
+
+	uint64_t *starts = malloc(sizeof(uint64_t) * num_lines);
+	int32_t *sizes = malloc(sizeof(int32_t) * num_lines);
+	size_t checkpoints_size = (num_checkpoints + 7) / 8;
+	unsigned char *checkpoints = calloc(checkpoints_size + 1, 1);
+	if (starts == NULL || sizes == NULL || checkpoints == NULL)
+		goto done;
+
+	for (int i = 0; i < num_lines; i++) {
+		line_t *line = document_get(document, i);
+		/* Lines that have been edited are not in the file any more. */
+		if (!line->is_mapped)
+			goto done;
+
+		starts[i] = line->chars - document->mapping;
+		sizes[i] = line->size;
+		if (i < num_checkpoints && line->highlight_open_comment)
+			checkpoints[i / 8] |= 1 << (i % 8);
+	}
+
+	struct linecache_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = LINECACHE_MAGIC;
+	header.num_lines = num_lines;
+	header.num_checkpoints = num_checkpoints;
+	header.key = document->mapping_key;
+	if (syntax != NULL)
+		strncpy(header.syntax, syntax->filetype, SYNTAX_NAME_SIZE - 1);
+
+	struct iovec parts[] = {
+		{ &header, sizeof(header) },
+		{ starts, sizeof(uint64_t) * num_lines },
+		{ sizes, sizeof(int32_t) * num_lines },
+		{ checkpoints, checkpoints_size }
+	};
+
+	if (cache_store(path, parts, 4))
+		document->cached_checkpoints = num_checkpoints;
+	else
+		warning("Failed to cache the lines of the file");
+
+done:
+	free(path);
+	free(starts);
+	free(sizes);
+	free(checkpoints);
+}
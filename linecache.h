@@ -0,0 +1,40 @@
+/*
+ * linecache.h: The lines of mapped files, kept between runs.
+ *
+ * When a file that was opened with a mapping is closed without changes, where
+ * each of its lines starts and ends is written to the cache, along with
+ * whether each line that had been highlighted so far ends inside a multi-line
+ * comment. Opening the same file again takes its lines from there instead of
+ * scanning all of its text, and only the lines that are drawn need to be
+ * highlighted. A cache is only used while the file still has the same size,
+ * modification time and sampled hash as when it was written.
+ */
+
+#ifndef _LINECACHE_H
+#define _LINECACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+struct document;
+struct editor_syntax;
+
+struct linecache_key {
+	uint64_t size;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	uint64_t hash;
+};
+
+void linecache_identify(struct linecache_key *, const char *mapping, const struct stat *);
+
+/* Add the lines of the document's mapped file from the cache, if it is there. */
+int linecache_load(struct document *, const char *filename, struct editor_syntax *);
+
+/*
+ * Write the lines of a document to the cache, if they are still exactly those
+ * of its mapped file, with the comment state of the first num_checkpoints.
+ */
+void linecache_store(struct document *, const char *filename, struct editor_syntax *, int num_checkpoints);
+
+#endif
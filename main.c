@@ -1,5 +1,7 @@
 #include "file.h"
 #include "editor.h"
+#include "journal.h"
+#include "preload.h"
 #include "window.h"
 
 int main(int argc, char** argv)
@@ -9,18 +11,25 @@ int main(int argc, char** argv)
 	struct editor_state editor;
 	init_editor(&editor);
 
+	preload_start();
+	journal_start();
+	/* Opening a file may replace this with a message about recovering it. */
+	editor_set_status_message(&editor, "HELP: Ctrl+Q: quit, Ctrl+S: save");
 	if (argc >= 2) {
 		editor_open(&editor, argv[1]);
 	}
+	/* Any other files are loaded in the background, to switch to with :bn and :bp. */
+	for (int i = 2; i < argc; i++)
+		editor_add_file(&editor, argv[i]);
 
-	editor_set_status_message(&editor, "HELP: Ctrl+Q: quit, Ctrl+S: save");
-
-	while (window_handle_event(&editor)) {
+	while (window_handle_events(&editor)) {
 		window_redraw(&editor);
 	}
 	
 	window_destroy();
 	editor_destroy(&editor);
+	journal_stop();
+	preload_stop();
 
 	return 0;
 }
@@ -0,0 +1,39 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Decide how many tasks to split an amount of work into: one per processor,
+ * unless that would make them smaller than the given minimum.
+ */
+int parallel_num_tasks(size_t amount, size_t min_per_task)
+{
+	long num_tasks = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_tasks > (long)(amount / min_per_task))
+		num_tasks = amount / min_per_task;
+	if (num_tasks > PARALLEL_MAX_TASKS)
+		num_tasks = PARALLEL_MAX_TASKS;
+	if (num_tasks < 1)
+		num_tasks = 1;
+	return num_tasks;
+}
+
+/* Run a function on each task and wait for all of them to finish. */
+void parallel_run(void *tasks, size_t task_size, int num_tasks, void *(*function)(void *))
+{
+	pthread_t threads[PARALLEL_MAX_TASKS];
+	int started[PARALLEL_MAX_TASKS];
+	char *task = tasks;
+
+	for (int k = 1; k < num_tasks; k++)
+		started[k] = pthread_create(&threads[k], NULL, function, task + k * task_size) == 0;
+
+	function(task);
+	for (int k = 1; k < num_tasks; k++) {
+		if (started[k])
+			pthread_join(threads[k], NULL);
+		else
+			function(task + k * task_size);
+	}
+}
@@ -0,0 +1,18 @@
+/*
+ * parallel.h: Splitting work between threads.
+ *
+ * The work is cut into tasks up front, which are all run at the same time:
+ * the first on the calling thread, and the rest on threads of their own.
+ */
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stddef.h>
+
+#define PARALLEL_MAX_TASKS 16
+
+int parallel_num_tasks(size_t amount, size_t min_per_task);
+void parallel_run(void *tasks, size_t task_size, int num_tasks, void *(*function)(void *));
+
+#endif
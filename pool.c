@@ -0,0 +1,145 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+
+/* Large blocks are kept in a list behind a header, so that they can all be found by pool_free. */
+struct pool_large {
+	struct pool_large *previous;
+	struct pool_large *next;
+	/* Keeps the block after the header aligned. */
+	size_t padding[2];
+};
+
+/* The first bytes of each slab point to the previous slab. */
+#define SLAB_HEADER_SIZE 16
+
+void pool_init(struct pool *pool)
+{
+	for (int i = 0; i < POOL_NUM_SIZES; i++)
+		pool->free_blocks[i] = NULL;
+	pool->slabs = NULL;
+	pool->slab_next = NULL;
+	pool->slab_left = 0;
+	pool->large = NULL;
+}
+
+static int size_index(size_t size)
+{
+	int index = 0;
+	size_t block = POOL_MIN_BLOCK;
+	while (block < size) {
+		block *= 2;
+		index++;
+	}
+	return index;
+}
+
+/* The size of the block that is given out for a request of some size. */
+size_t pool_block_size(size_t size)
+{
+	if (size > POOL_MAX_BLOCK)
+		return size;
+	return (size_t)POOL_MIN_BLOCK << size_index(size);
+}
+
+static void *alloc_large(struct pool *pool, size_t size)
+{
+	struct pool_large *large = malloc(sizeof(struct pool_large) + size);
+	if (large == NULL)
+		fatal_error("Failed to allocate %zu bytes for a line\n", size);
+
+	large->previous = NULL;
+	large->next = pool->large;
+	if (pool->large != NULL)
+		pool->large->previous = large;
+	pool->large = large;
+	return large + 1;
+}
+
+static void release_large(struct pool *pool, void *block)
+{
+	struct pool_large *large = (struct pool_large *)block - 1;
+	if (large->previous != NULL)
+		large->previous->next = large->next;
+	else
+		pool->large = large->next;
+	if (large->next != NULL)
+		large->next->previous = large->previous;
+	free(large);
+}
+
+void *pool_alloc(struct pool *pool, size_t size)
+{
+	if (size > POOL_MAX_BLOCK)
+		return alloc_large(pool, size);
+
+	int index = size_index(size);
+	void *block = pool->free_blocks[index];
+	if (block != NULL) {
+		memcpy(&pool->free_blocks[index], block, sizeof(void *));
+		return block;
+	}
+
+	size_t block_size = (size_t)POOL_MIN_BLOCK << index;
+	if (pool->slab_left < block_size) {
+		char *slab = malloc(POOL_SLAB_SIZE);
+		if (slab == NULL)
+			fatal_error("Failed to allocate a slab for lines\n");
+		memcpy(slab, &pool->slabs, sizeof(void *));
+		pool->slabs = slab;
+		pool->slab_next = slab + SLAB_HEADER_SIZE;
+		pool->slab_left = POOL_SLAB_SIZE - SLAB_HEADER_SIZE;
+	}
+
+	block = pool->slab_next;
+	pool->slab_next += block_size;
+	pool->slab_left -= block_size;
+	return block;
+}
+
+/* Give a block back, with the size it was asked for with. */
+void pool_release(struct pool *pool, void *block, size_t size)
+{
+	if (block == NULL)
+		return;
+	if (size > POOL_MAX_BLOCK) {
+		release_large(pool, block);
+		return;
+	}
+
+	int index = size_index(size);
+	memcpy(block, &pool->free_blocks[index], sizeof(void *));
+	pool->free_blocks[index] = block;
+}
+
+/* Move the first bytes of a block to one of a different size. */
+void *pool_resize(struct pool *pool, void *block, size_t old_size, size_t new_size, size_t keep)
+{
+	if (block != NULL && pool_block_size(old_size) == pool_block_size(new_size))
+		return block;
+
+	void *new_block = pool_alloc(pool, new_size);
+	if (block != NULL) {
+		memcpy(new_block, block, keep);
+		pool_release(pool, block, old_size);
+	}
+	return new_block;
+}
+
+void pool_free(struct pool *pool)
+{
+	while (pool->slabs != NULL) {
+		void *slab = pool->slabs;
+		memcpy(&pool->slabs, slab, sizeof(void *));
+		free(slab);
+	}
+	while (pool->large != NULL) {
+		struct pool_large *next = pool->large->next;
+		free(pool->large);
+		pool->large = next;
+	}
+	pool_init(pool);
+}
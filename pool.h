@@ -0,0 +1,39 @@
+/*
+ * pool.h: Memory for the text of a document's lines.
+ *
+ * Blocks come in power of two sizes. They are cut from large slabs and kept
+ * on a free list for their size once released, so lines that change size
+ * often reuse the same memory. Blocks larger than the largest size are
+ * allocated on their own. Everything in a pool is released at once by
+ * pool_free, instead of line by line.
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stddef.h>
+
+#define POOL_MIN_BLOCK 16
+#define POOL_MAX_BLOCK 4096
+#define POOL_NUM_SIZES 9
+#define POOL_SLAB_SIZE (64 * 1024)
+
+struct pool_large;
+
+struct pool {
+	void *free_blocks[POOL_NUM_SIZES];
+	/* The slabs are chained through their first bytes, and blocks are cut from the end of the last. */
+	void *slabs;
+	char *slab_next;
+	size_t slab_left;
+	struct pool_large *large;
+};
+
+void pool_init(struct pool *);
+size_t pool_block_size(size_t size);
+void *pool_alloc(struct pool *, size_t size);
+void *pool_resize(struct pool *, void *block, size_t old_size, size_t new_size, size_t keep);
+void pool_release(struct pool *, void *block, size_t size);
+void pool_free(struct pool *);
+
+#endif
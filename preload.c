@@ -0,0 +1,257 @@
+#include "preload.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "file.h"
+
+enum entry_state {
+	ENTRY_UNUSED,
+	ENTRY_QUEUED,
+	ENTRY_LOADING,
+	ENTRY_READY
+};
+
+struct preload_entry {
+	enum entry_state state;
+	char *path;
+	/* The file as it was when it was loaded, to tell whether it has changed since. */
+	struct timespec mtime;
+	off_t size;
+	struct document document;
+	/* When the entry was last queued or kept, for finding the least recently used. */
+	unsigned long last_used;
+};
+
+static struct preload_entry entries[PRELOAD_CACHE_SIZE];
+static unsigned long use_counter = 0;
+
+static pthread_t thread;
+static int thread_running = 0;
+static int thread_quit = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static void clear_entry(struct preload_entry *entry)
+{
+	free(entry->path);
+	document_free(&entry->document);
+	entry->path = NULL;
+	entry->state = ENTRY_UNUSED;
+}
+
+/* The next file to load, in the order they were queued. */
+static struct preload_entry *next_queued(void)
+{
+	struct preload_entry *next = NULL;
+	for (int i = 0; i < PRELOAD_CACHE_SIZE; i++) {
+		if (entries[i].state == ENTRY_QUEUED && (next == NULL || entries[i].last_used < next->last_used))
+			next = &entries[i];
+	}
+	return next;
+}
+
+/* Load a file into an entry, leaving it empty if it can not be mapped. */
+static void load_entry(struct preload_entry *entry, const char *path, struct document *document)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && file_map_document(document, fd, path)) {
+		entry->mtime = st.st_mtim;
+		entry->size = st.st_size;
+	}
+	close(fd);
+}
+
+static void *preload_thread(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		struct preload_entry *entry;
+		while ((entry = next_queued()) == NULL && !thread_quit)
+			pthread_cond_wait(&cond, &lock);
+		if (thread_quit)
+			break;
+
+		/* The entry is left alone while it is loading, so it can be filled in without the lock. */
+		entry->state = ENTRY_LOADING;
+		pthread_mutex_unlock(&lock);
+
+		struct document document;
+		document_init(&document);
+		load_entry(entry, entry->path, &document);
+
+		pthread_mutex_lock(&lock);
+		entry->document = document;
+		entry->state = ENTRY_READY;
+		pthread_cond_broadcast(&done_cond);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void preload_start(void)
+{
+	for (int i = 0; i < PRELOAD_CACHE_SIZE; i++) {
+		entries[i].state = ENTRY_UNUSED;
+		entries[i].path = NULL;
+		document_init(&entries[i].document);
+	}
+
+	thread_quit = 0;
+	if (pthread_create(&thread, NULL, preload_thread, NULL) != 0)
+		fatal_error("Failed to start the preloading thread\n");
+	thread_running = 1;
+}
+
+void preload_stop(void)
+{
+	if (!thread_running)
+		return;
+
+	pthread_mutex_lock(&lock);
+	thread_quit = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	thread_running = 0;
+
+	for (int i = 0; i < PRELOAD_CACHE_SIZE; i++)
+		clear_entry(&entries[i]);
+}
+
+static struct preload_entry *find_entry(const char *path)
+{
+	for (int i = 0; i < PRELOAD_CACHE_SIZE; i++) {
+		if (entries[i].state != ENTRY_UNUSED && strcmp(entries[i].path, path) == 0)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+/*
+ * Find room for another entry, dropping the least recently used file that is
+ * ready. Files that are still to be loaded are kept, so that queueing many
+ * files does not throw away the first ones, which are wanted soonest.
+ */
+static struct preload_entry *new_entry(const char *path)
+{
+	struct preload_entry *entry = NULL;
+	for (int i = 0; i < PRELOAD_CACHE_SIZE; i++) {
+		if (entries[i].state == ENTRY_UNUSED) {
+			entry = &entries[i];
+			break;
+		}
+		if (entries[i].state == ENTRY_READY && (entry == NULL || entries[i].last_used < entry->last_used))
+			entry = &entries[i];
+	}
+	if (entry == NULL)
+		return NULL;
+
+	clear_entry(entry);
+	entry->path = strdup(path);
+	entry->size = -1;
+	entry->last_used = ++use_counter;
+	return entry;
+}
+
+/* Load a file on the preloading thread, unless it is already cached. */
+void preload_file(const char *path)
+{
+	if (!thread_running)
+		return;
+
+	pthread_mutex_lock(&lock);
+	struct preload_entry *entry = find_entry(path);
+	if (entry != NULL) {
+		entry->last_used = ++use_counter;
+	} else if ((entry = new_entry(path)) != NULL) {
+		entry->state = ENTRY_QUEUED;
+		pthread_cond_signal(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* Whether a file is still the one an entry was loaded from. */
+static int entry_is_current(struct preload_entry *entry, const char *path)
+{
+	struct stat st;
+	return entry->size >= 0 && stat(path, &st) == 0 && st.st_size == entry->size
+		&& st.st_mtim.tv_sec == entry->mtime.tv_sec && st.st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+
+void preload_keep(const char *path, struct document *document)
+{
+	/* Only a mapped document knows which version of the file it was loaded from. */
+	if (!thread_running || document->mapping == NULL) {
+		document_free(document);
+		return;
+	}
+
+	/* A copy that is being loaded will do instead, and one that is waiting to be is replaced. */
+	pthread_mutex_lock(&lock);
+	struct preload_entry *entry = find_entry(path);
+	if (entry != NULL && entry->state == ENTRY_LOADING)
+		entry = NULL;
+	else if (entry == NULL)
+		entry = new_entry(path);
+	else
+		document_free(&entry->document);
+
+	if (entry == NULL) {
+		pthread_mutex_unlock(&lock);
+		document_free(document);
+		return;
+	}
+
+	entry->document = *document;
+	entry->mtime.tv_sec = document->mapping_key.mtime;
+	entry->mtime.tv_nsec = document->mapping_key.mtime_nsec;
+	entry->size = document->mapping_key.size;
+	entry->state = ENTRY_READY;
+	entry->last_used = ++use_counter;
+
+	/* The file may have been changed on disk while it was open. */
+	if (!entry_is_current(entry, path))
+		clear_entry(entry);
+	pthread_mutex_unlock(&lock);
+}
+
+int preload_take(const char *path, struct document *document)
+{
+	if (!thread_running)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	struct preload_entry *entry = find_entry(path);
+	while (entry != NULL && entry->state == ENTRY_LOADING) {
+		pthread_cond_wait(&done_cond, &lock);
+		entry = find_entry(path);
+	}
+
+	/* A file that has not been started on is loaded just as quickly by the caller. */
+	if (entry == NULL || entry->state != ENTRY_READY) {
+		if (entry != NULL)
+			clear_entry(entry);
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+
+	int is_current = entry_is_current(entry, path);
+	if (is_current) {
+		*document = entry->document;
+		document_init(&entry->document);
+	}
+	clear_entry(entry);
+	pthread_mutex_unlock(&lock);
+	return is_current;
+}
@@ -0,0 +1,39 @@
+/*
+ * preload.h: Loading files in the background before they are opened.
+ *
+ * Files that are likely to be opened next, such as the other files named on
+ * the command line, are mapped and split into lines on a thread of their own
+ * while the user edits. Files that are closed without changes are kept too,
+ * along with their highlighting. A few of these documents are cached, and the
+ * least recently used is dropped to make room for another. Opening a cached
+ * file takes its lines as they are, as long as the file has not changed since.
+ */
+
+#ifndef _PRELOAD_H
+#define _PRELOAD_H
+
+#include "document.h"
+
+/* How many documents are kept ready to open at once. */
+#define PRELOAD_CACHE_SIZE 16
+
+/* Without the thread, files are only loaded when they are opened. */
+void preload_start(void);
+void preload_stop(void);
+
+void preload_file(const char *path);
+
+/*
+ * Give the cache a document that has not been changed since it was mapped
+ * from the file at a path. It is freed once it is no longer needed, or right
+ * away if the file has been changed on disk since.
+ */
+void preload_keep(const char *path, struct document *document);
+
+/*
+ * Take the lines of a file out of the cache, waiting if they are being loaded
+ * right now. Returns 0 if they are not there, or the file has changed since.
+ */
+int preload_take(const char *path, struct document *document);
+
+#endif
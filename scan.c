@@ -0,0 +1,148 @@
+#include "scan.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t count_scalar(const char *text, size_t length, char c)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < length; i++)
+		count += (text[i] == c);
+	return count;
+}
+
+/* The positions functions scan the text from the given start offset onwards. */
+static size_t positions_scalar(const char *text, size_t start, size_t length, char c, int *positions)
+{
+	size_t count = 0;
+	for (size_t i = start; i < length; i++)
+		if (text[i] == c)
+			positions[count++] = i;
+	return count;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * The matches of each block are added up in byte sized counters, which are
+ * added to the total before they can overflow.
+ */
+static size_t count_sse2(const char *text, size_t length, char c)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0;
+	size_t i = 0;
+
+	while (length - i >= 16) {
+		__m128i counters = zero;
+		for (int block = 0; block < 255 && length - i >= 16; block++, i += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)&text[i]);
+			counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(chunk, needle));
+		}
+		__m128i sums = _mm_sad_epu8(counters, zero);
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+
+	return count + count_scalar(&text[i], length - i, c);
+}
+
+static size_t positions_sse2(const char *text, size_t start, size_t length, char c, int *positions)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+	size_t count = 0;
+	size_t i = start;
+
+	for (; length - i >= 16; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)&text[i]);
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		while (mask) {
+			positions[count++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return count + positions_scalar(text, i, length, c, &positions[count]);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *text, size_t length, char c)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+	const __m256i zero = _mm256_setzero_si256();
+	size_t count = 0;
+	size_t i = 0;
+
+	while (length - i >= 32) {
+		__m256i counters = zero;
+		for (int block = 0; block < 255 && length - i >= 32; block++, i += 32) {
+			__m256i chunk = _mm256_loadu_si256((const __m256i *)&text[i]);
+			counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(chunk, needle));
+		}
+		__m256i sums = _mm256_sad_epu8(counters, zero);
+		count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+			+ _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+	}
+
+	return count + count_sse2(&text[i], length - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t positions_avx2(const char *text, size_t start, size_t length, char c, int *positions)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+	size_t count = 0;
+	size_t i = start;
+
+	for (; length - i >= 32; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)&text[i]);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		while (mask) {
+			positions[count++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return count + positions_sse2(text, i, length, c, &positions[count]);
+}
+
+#endif
+
+static size_t (*count_impl)(const char *, size_t, char);
+static size_t (*positions_impl)(const char *, size_t, size_t, char, int *);
+
+/* Pick the fastest version of each function that this processor can run. */
+static void select_impl(void)
+{
+#ifdef SCAN_X86
+	if (__builtin_cpu_supports("avx2")) {
+		count_impl = count_avx2;
+		positions_impl = positions_avx2;
+	} else {
+		count_impl = count_sse2;
+		positions_impl = positions_sse2;
+	}
+#else
+	count_impl = count_scalar;
+	positions_impl = positions_scalar;
+#endif
+}
+
+/* The first calls may come from several threads at once. */
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+size_t scan_count(const char *text, size_t length, char c)
+{
+	pthread_once(&select_once, select_impl);
+	return count_impl(text, length, c);
+}
+
+size_t scan_positions(const char *text, size_t length, char c, int *positions)
+{
+	pthread_once(&select_once, select_impl);
+	return positions_impl(text, 0, length, c, positions);
+}
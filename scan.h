@@ -0,0 +1,23 @@
+/*
+ * scan.h: Fast searching of text for a single byte.
+ *
+ * On x86-64 these use SSE2, or AVX2 when the processor supports it, and fall
+ * back to plain loops elsewhere. The version to use is picked the first time
+ * either function is called, and they can be called from any thread.
+ */
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stddef.h>
+
+/* Count how many times a byte appears in the text. */
+size_t scan_count(const char *text, size_t length, char c);
+
+/*
+ * Store the offset of every appearance of a byte in the text. The positions
+ * array must have room for all of them. Returns how many were found.
+ */
+size_t scan_positions(const char *text, size_t length, char c, int *positions);
+
+#endif
@@ -0,0 +1,444 @@
+#include "search.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "editor.h"
+#include "error.h"
+#include "parallel.h"
+
+/* Documents are searched on several threads, in parts of at least this many lines. */
+#define SEARCH_MIN_TASK_LINES 50000
+
+struct search_task {
+	struct document *document;
+	struct search *search;
+	/* The compiled pattern this task matches with, if the search is a regular expression. */
+	regex_t *regex;
+	regex_t own_regex;
+	/* Lines are copied here to be NUL terminated for regexec. */
+	char *text;
+	size_t text_capacity;
+	int first_line, last_line;
+	struct search results;
+};
+
+void search_init(struct search *search)
+{
+	search->query = NULL;
+	search->query_length = 0;
+	search->is_regex = 0;
+	search->literal = NULL;
+	search->literal_length = 0;
+	search->matches = NULL;
+	search->num_matches = 0;
+	search->capacity = 0;
+	search->origin_x = 0;
+	search->origin_y = 0;
+}
+
+/* Forget the query, keeping the match list's memory. */
+static void clear_query(struct search *search)
+{
+	free(search->query);
+	free(search->literal);
+	if (search->is_regex)
+		regfree(&search->regex);
+
+	search->query = NULL;
+	search->query_length = 0;
+	search->is_regex = 0;
+	search->literal = NULL;
+	search->literal_length = 0;
+	search->num_matches = 0;
+}
+
+void search_free(struct search *search)
+{
+	clear_query(search);
+	free(search->matches);
+	search_init(search);
+}
+
+static void reserve_matches(struct search *search, int count)
+{
+	if (count <= search->capacity)
+		return;
+
+	int new_capacity = search->capacity ? search->capacity * 2 : 64;
+	while (new_capacity < count)
+		new_capacity *= 2;
+
+	search->matches = realloc(search->matches, sizeof(struct search_match) * new_capacity);
+	if (search->matches == NULL)
+		fatal_error("Failed to grow the search results to %d matches\n", new_capacity);
+	search->capacity = new_capacity;
+}
+
+static void add_match(struct search *search, int line, int x, int length)
+{
+	reserve_matches(search, search->num_matches + 1);
+	search->matches[search->num_matches++] = (struct search_match){ line, x, length };
+}
+
+/*
+ * Find some text in a line. Possible matches are found by looking for the
+ * first byte with memchr, which is vectorised, and only those are compared in
+ * full.
+ */
+static const char *find_text(const char *p, const char *end, const char *text, size_t length)
+{
+	while ((size_t)(end - p) >= length) {
+		p = memchr(p, text[0], (end - p) - length + 1);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p + 1, text + 1, length - 1) == 0)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+static void search_line_text(struct search_task *task, int index, line_t *line)
+{
+	const char *query = task->search->query;
+	size_t length = task->search->query_length;
+	const char *end = line->chars + line->size;
+	const char *p = line->chars;
+
+	if (length == 0)
+		return;
+
+	while ((p = find_text(p, end, query, length)) != NULL) {
+		add_match(&task->results, index, p - line->chars, length);
+		p += length;
+	}
+}
+
+static void search_line_regex(struct search_task *task, int index, line_t *line)
+{
+	struct search *search = task->search;
+
+	/* Most lines of a large file can be ruled out without running the pattern. */
+	if (search->literal_length > 0 && find_text(line->chars, line->chars + line->size, search->literal, search->literal_length) == NULL)
+		return;
+
+	if ((size_t)line->size + 1 > task->text_capacity) {
+		task->text_capacity = (line->size + 1) * 2;
+		task->text = realloc(task->text, task->text_capacity);
+		if (task->text == NULL)
+			fatal_error("Failed to allocate %d bytes to search a line\n", line->size + 1);
+	}
+	memcpy(task->text, line->chars, line->size);
+	task->text[line->size] = '\0';
+
+	int x = 0;
+	while (x <= line->size) {
+		regmatch_t match;
+		if (regexec(task->regex, task->text + x, 1, &match, x > 0 ? REG_NOTBOL : 0) != 0)
+			break;
+
+		add_match(&task->results, index, x + match.rm_so, match.rm_eo - match.rm_so);
+
+		/* Step over empty matches so that they are not found again. */
+		x += match.rm_eo > match.rm_so ? match.rm_eo : match.rm_so + 1;
+	}
+}
+
+static void search_line(struct search_task *task, int index, line_t *line)
+{
+	if (task->search->is_regex)
+		search_line_regex(task, index, line);
+	else
+		search_line_text(task, index, line);
+}
+
+static void *search_lines(void *arg)
+{
+	struct search_task *task = arg;
+
+	for (int j = task->first_line; j < task->last_line; j++)
+		search_line(task, j, document_get(task->document, j));
+	return NULL;
+}
+
+static void init_task(struct search_task *task, struct editor_state *editor)
+{
+	task->document = &editor->document;
+	task->search = &editor->search;
+	task->regex = &editor->search.regex;
+	task->text = NULL;
+	task->text_capacity = 0;
+	task->first_line = 0;
+	task->last_line = 0;
+	search_init(&task->results);
+}
+
+static void free_task(struct search_task *task)
+{
+	if (task->regex == &task->own_regex)
+		regfree(&task->own_regex);
+	free(task->text);
+	search_free(&task->results);
+}
+
+/*
+ * Find the longest run of plain characters that every match of an extended
+ * regular expression contains. Anything in a bracket expression or a group,
+ * or followed by a repetition that lets it be left out, ends a run, and
+ * patterns with alternatives have none.
+ */
+static char *required_literal(const char *pattern, size_t length, size_t *literal_length)
+{
+	char *run = malloc(length + 1);
+	char *best = malloc(length + 1);
+	size_t run_length = 0;
+	size_t best_length = 0;
+	int depth = 0;
+
+	for (size_t i = 0; i < length; i++) {
+		char c = pattern[i];
+		int is_literal = 0;
+
+		if (c == '|') {
+			best_length = run_length = 0;
+			break;
+		} else if (c == '\\' && i + 1 < length) {
+			c = pattern[++i];
+			is_literal = depth == 0 && strchr(".[]()*+?{}|^$\\", c) != NULL;
+		} else if (c == '[') {
+			/* Skip to the closing bracket, which may come first in the list. */
+			i++;
+			if (i < length && pattern[i] == '^')
+				i++;
+			if (i < length && pattern[i] == ']')
+				i++;
+			while (i < length && pattern[i] != ']') {
+				if (pattern[i] == '[' && i + 1 < length && strchr(":.=", pattern[i + 1])) {
+					char close = pattern[i + 1];
+					for (i += 2; i + 1 < length && !(pattern[i] == close && pattern[i + 1] == ']'); i++)
+						;
+					i++;
+				}
+				i++;
+			}
+		} else if (c == '(') {
+			depth++;
+		} else if (c == ')') {
+			depth--;
+		} else {
+			is_literal = depth == 0 && strchr(".^$*+?{}", c) == NULL;
+		}
+
+		int next = i + 1 < length ? pattern[i + 1] : '\0';
+		if (is_literal && next != '\0' && strchr("*?{", next) != NULL)
+			is_literal = 0;
+
+		if (is_literal)
+			run[run_length++] = c;
+
+		/* A repeated character is still needed once, but whatever follows may come after more of it. */
+		if (!is_literal || next == '+') {
+			if (run_length > best_length) {
+				memcpy(best, run, run_length);
+				best_length = run_length;
+			}
+			run_length = 0;
+		}
+	}
+
+	if (run_length > best_length) {
+		memcpy(best, run, run_length);
+		best_length = run_length;
+	}
+	free(run);
+
+	*literal_length = best_length;
+	if (best_length == 0) {
+		free(best);
+		return NULL;
+	}
+	best[best_length] = '\0';
+	return best;
+}
+
+/* Find the first match on or after the given line. */
+int search_find_line(struct search *search, int line)
+{
+	int low = 0, high = search->num_matches;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (search->matches[middle].line < line)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+ * Find the matches of the current query in the whole document. Returns zero,
+ * or the error from compiling a task's own copy of a regular expression, in
+ * which case nothing is searched.
+ */
+static int search_document(struct editor_state *editor)
+{
+	struct search *search = &editor->search;
+	search->num_matches = 0;
+
+	struct search_task tasks[PARALLEL_MAX_TASKS];
+	int num_tasks = parallel_num_tasks(editor->num_lines, SEARCH_MIN_TASK_LINES);
+	for (int k = 0; k < num_tasks; k++) {
+		init_task(&tasks[k], editor);
+		tasks[k].first_line = (long)editor->num_lines * k / num_tasks;
+		tasks[k].last_line = (long)editor->num_lines * (k + 1) / num_tasks;
+
+		/* glibc lets one thread at a time run a compiled pattern, so the others need their own. */
+		if (search->is_regex && k > 0) {
+			int error = regcomp(&tasks[k].own_regex, search->query, REG_EXTENDED);
+			if (error != 0) {
+				for (int j = 0; j <= k; j++)
+					free_task(&tasks[j]);
+				return error;
+			}
+			tasks[k].regex = &tasks[k].own_regex;
+		}
+	}
+	parallel_run(tasks, sizeof(*tasks), num_tasks, search_lines);
+
+	/* Each task searched the lines after the previous one's, so they only need joining up. */
+	for (int k = 0; k < num_tasks; k++) {
+		struct search *results = &tasks[k].results;
+		reserve_matches(search, search->num_matches + results->num_matches);
+		memcpy(&search->matches[search->num_matches], results->matches, sizeof(struct search_match) * results->num_matches);
+		search->num_matches += results->num_matches;
+		free_task(&tasks[k]);
+	}
+
+	editor_damage_all(editor);
+	return 0;
+}
+
+/*
+ * The match list is kept up to date as lines change, so searching for the same
+ * thing again does not need to look at the document.
+ */
+static int is_current_query(struct search *search, const char *query, size_t length, int is_regex)
+{
+	return search->query != NULL && search->is_regex == is_regex && search->query_length == length
+		&& memcmp(search->query, query, length) == 0;
+}
+
+static void set_query(struct search *search, const char *query, size_t length)
+{
+	clear_query(search);
+	search->query = malloc(length + 1);
+	memcpy(search->query, query, length);
+	search->query[length] = '\0';
+	search->query_length = length;
+}
+
+/* Search the whole document, replacing the matches of any previous search. */
+void editor_search(struct editor_state *editor, const char *query, size_t length)
+{
+	if (is_current_query(&editor->search, query, length, 0))
+		return;
+
+	set_query(&editor->search, query, length);
+	search_document(editor);
+}
+
+/*
+ * Search the whole document for an extended regular expression, which is
+ * compiled once for the search and the edits made while it is shown, and once
+ * more for each thread that searches it. Returns zero, or the error from
+ * regcomp, in which case there are no matches.
+ */
+int editor_search_regex(struct editor_state *editor, const char *pattern, size_t length)
+{
+	struct search *search = &editor->search;
+	if (is_current_query(search, pattern, length, 1))
+		return 0;
+
+	set_query(search, pattern, length);
+	int error = regcomp(&search->regex, search->query, REG_EXTENDED);
+	if (error != 0) {
+		char message[128];
+		regerror(error, &search->regex, message, sizeof(message));
+		editor_set_status_message(editor, "Invalid regular expression: %s", message);
+		editor_search_clear(editor);
+		return error;
+	}
+
+	search->is_regex = 1;
+	search->literal = required_literal(pattern, length, &search->literal_length);
+	error = search_document(editor);
+	if (error != 0) {
+		char message[128];
+		regerror(error, &search->regex, message, sizeof(message));
+		editor_set_status_message(editor, "Failed to search for the regular expression: %s", message);
+		editor_search_clear(editor);
+		return error;
+	}
+	return 0;
+}
+
+void editor_search_clear(struct editor_state *editor)
+{
+	clear_query(&editor->search);
+	editor_damage_all(editor);
+}
+
+/* Put a line's new matches in place of its old ones. */
+static void replace_line_matches(struct search *search, int at, struct search *found)
+{
+	int first = search_find_line(search, at);
+	int end = search_find_line(search, at + 1);
+	if (first == end && found->num_matches == 0)
+		return;
+
+	int new_count = search->num_matches - (end - first) + found->num_matches;
+
+	reserve_matches(search, new_count);
+	memmove(&search->matches[first + found->num_matches], &search->matches[end], sizeof(struct search_match) * (search->num_matches - end));
+	memcpy(&search->matches[first], found->matches, sizeof(struct search_match) * found->num_matches);
+	search->num_matches = new_count;
+}
+
+/* Search a line again after its text has changed. */
+void editor_search_update_line(struct editor_state *editor, int at)
+{
+	if (editor->search.query == NULL)
+		return;
+
+	struct search_task task;
+	init_task(&task, editor);
+	search_line(&task, at, document_get(&editor->document, at));
+	replace_line_matches(&editor->search, at, &task.results);
+	free_task(&task);
+}
+
+/* Move the matches below a newly inserted line down. The line itself is searched once it is filled in. */
+void editor_search_insert_line(struct editor_state *editor, int at)
+{
+	struct search *search = &editor->search;
+	if (search->query == NULL)
+		return;
+
+	for (int i = search_find_line(search, at); i < search->num_matches; i++)
+		search->matches[i].line++;
+}
+
+void editor_search_delete_line(struct editor_state *editor, int at)
+{
+	struct search *search = &editor->search;
+	if (search->query == NULL)
+		return;
+
+	struct search none;
+	search_init(&none);
+
+	replace_line_matches(search, at, &none);
+	for (int i = search_find_line(search, at + 1); i < search->num_matches; i++)
+		search->matches[i].line--;
+}
@@ -0,0 +1,51 @@
+/*
+ * search.h: Finding every match of a search in a document.
+ *
+ * The matches are kept in a list in document order, which is kept up to date
+ * as lines are edited, inserted and deleted, and which the window draws on top
+ * of the syntax highlighting.
+ */
+
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include <stddef.h>
+#include <regex.h>
+
+struct editor_state;
+
+/* A match, in characters of the line's text rather than display columns. */
+struct search_match {
+	int line;
+	int x;
+	int length;
+};
+
+struct search {
+	char *query;
+	size_t query_length;
+	/* Set if the query is an extended regular expression, compiled into regex. */
+	int is_regex;
+	regex_t regex;
+	/* Text that every match of the expression contains, or NULL. */
+	char *literal;
+	size_t literal_length;
+	struct search_match *matches;
+	int num_matches;
+	int capacity;
+	/* Where the cursor was when the search was started. */
+	int origin_x, origin_y;
+};
+
+void search_init(struct search *);
+void search_free(struct search *);
+int search_find_line(struct search *, int line);
+
+void editor_search(struct editor_state *, const char *query, size_t length);
+int editor_search_regex(struct editor_state *, const char *pattern, size_t length);
+void editor_search_clear(struct editor_state *);
+void editor_search_update_line(struct editor_state *, int at);
+void editor_search_insert_line(struct editor_state *, int at);
+void editor_search_delete_line(struct editor_state *, int at);
+
+#endif
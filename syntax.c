@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "editor.h"
+#include "error.h"
 
 char* c_highlight_extensions[] = { ".c", ".h", ".cpp", ".cc", NULL };
 
@@ -31,69 +32,138 @@ int is_separator(int c)
 	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void editor_update_syntax(struct editor_state *editor, line_t *line)
+static struct keyword_trie *compile_keywords(char **keywords)
 {
-	line->highlight = realloc(line->highlight, line->render_size);
-	memset(line->highlight, HIGHLIGHT_NORMAL, line->render_size);
+	struct keyword_trie *trie = malloc(sizeof(*trie));
 
-	if (editor->syntax == NULL)
-		return;
+	/* There can not be more nodes than keyword characters plus the root. */
+	int max_nodes = 1;
+	for (int j = 0; keywords[j]; j++)
+		max_nodes += strlen(keywords[j]);
+
+	trie->num_nodes = 1;
+	trie->next = calloc(max_nodes, sizeof(*trie->next));
+	trie->keyword_type = calloc(max_nodes, 1);
+
+	for (int j = 0; keywords[j]; j++) {
+		int keyword_length = strlen(keywords[j]);
+		int is_secondary = keywords[j][keyword_length - 1] == '|';
+
+		if (is_secondary)
+			keyword_length--;
+
+		int node = 0;
+		for (int k = 0; k < keyword_length; k++) {
+			unsigned char c = keywords[j][k];
+			if (c >= KEYWORD_ALPHABET_SIZE)
+				fatal_error("Keyword '%s' is not ASCII\n", keywords[j]);
+
+			if (trie->next[node][c] == 0)
+				trie->next[node][c] = trie->num_nodes++;
+			node = trie->next[node][c];
+		}
+
+		/* Like before, the first keyword in the list wins. */
+		if (trie->keyword_type[node] == HIGHLIGHT_NORMAL)
+			trie->keyword_type[node] = is_secondary ? HIGHLIGHT_KEYWORD2 : HIGHLIGHT_KEYWORD1;
+	}
+
+	return trie;
+}
+
+/*
+ * Find the keyword starting at the given position of the text. Returns its
+ * length and sets its highlight type, or returns 0 if there is none.
+ */
+static int match_keyword(struct keyword_trie *trie, const char *text, int size, int i, int *type)
+{
+	int node = 0;
+	int match_length = 0;
 
-	char** keywords = editor->syntax->keywords;
+	for (int k = i; k < size; k++) {
+		unsigned char c = text[k];
+		if (c >= KEYWORD_ALPHABET_SIZE || (node = trie->next[node][c]) == 0)
+			break;
 
+		if (trie->keyword_type[node] != HIGHLIGHT_NORMAL && is_separator(k + 1 < size ? text[k + 1] : '\0')) {
+			match_length = k + 1 - i;
+			*type = trie->keyword_type[node];
+		}
+	}
+
+	return match_length;
+}
+
+/* Check whether a delimiter starts at the given position of the text. */
+static int starts_with(const char *text, int size, int i, const char *delimiter, int delimiter_length)
+{
+	return size - i >= delimiter_length && !strncmp(&text[i], delimiter, delimiter_length);
+}
+
+/* Set the highlight of some characters, unless only the line state is wanted. */
+static void mark(unsigned char *highlight, int i, int type, int count)
+{
+	if (highlight != NULL)
+		memset(&highlight[i], type, count);
+}
+
+int syntax_highlight_text(struct editor_syntax *syntax, const char *text, int size, unsigned char *highlight, int in_comment)
+{
 	// TODO: Remove
-	char* single_line_comment_start = editor->syntax->single_line_comment_start;
-	char* multi_line_comment_start = editor->syntax->multi_line_comment_start;
-	char* multi_line_comment_end = editor->syntax->multi_line_comment_end;
+	char* single_line_comment_start = syntax->single_line_comment_start;
+	char* multi_line_comment_start = syntax->multi_line_comment_start;
+	char* multi_line_comment_end = syntax->multi_line_comment_end;
 	
 	int single_line_comment_start_length = single_line_comment_start ? strlen(single_line_comment_start) : 0;
 	int multi_line_comment_start_length = multi_line_comment_start ? strlen(multi_line_comment_start) : 0;
 	int multi_line_comment_end_length = multi_line_comment_end ? strlen(multi_line_comment_end) : 0;
 
 	int previous_separator = 1;
+	unsigned char previous_highlight = HIGHLIGHT_NORMAL;
 	int in_string = 0;
-	int in_comment = (line->index > 0 && editor->lines[line->index - 1].highlight_open_comment);
 
 	int i = 0;
-	while (i < line->render_size) {
-		char c = line->render[i];
-		unsigned char previous_highlight = (i > 0) ? line->highlight[i - 1] : HIGHLIGHT_NORMAL;
+	while (i < size) {
+		char c = text[i];
 
 		if (single_line_comment_start_length && !in_string && !in_comment) {
-			if (!strncmp(&line->render[i], single_line_comment_start, single_line_comment_start_length)) {
-				memset(&line->highlight[i], HIGHLIGHT_COMMENT, line->render_size - i);
+			if (starts_with(text, size, i, single_line_comment_start, single_line_comment_start_length)) {
+				mark(highlight, i, HIGHLIGHT_COMMENT, size - i);
 				break;
 			}			
 		}
 
 		if (multi_line_comment_start_length && multi_line_comment_end_length && !in_string) {
 			if (in_comment) {
-				line->highlight[i] = HIGHLIGHT_MULTILINE_COMMENT;
-				if (!strncmp(&line->render[i], multi_line_comment_end, multi_line_comment_end_length)) {
-					memset(&line->highlight[i], HIGHLIGHT_MULTILINE_COMMENT, multi_line_comment_end_length);
+				previous_highlight = HIGHLIGHT_MULTILINE_COMMENT;
+				if (starts_with(text, size, i, multi_line_comment_end, multi_line_comment_end_length)) {
+					mark(highlight, i, HIGHLIGHT_MULTILINE_COMMENT, multi_line_comment_end_length);
 
 					i += multi_line_comment_end_length;
 					in_comment = 0;
 					previous_separator = 1;
 					continue;
 				} else {
+					mark(highlight, i, HIGHLIGHT_MULTILINE_COMMENT, 1);
 					i++;
 					continue;
 				}
-			} else if (!strncmp(&line->render[i], multi_line_comment_start, multi_line_comment_start_length)) {
-				memset(&line->highlight[i], HIGHLIGHT_MULTILINE_COMMENT, multi_line_comment_start_length);
+			} else if (starts_with(text, size, i, multi_line_comment_start, multi_line_comment_start_length)) {
+				mark(highlight, i, HIGHLIGHT_MULTILINE_COMMENT, multi_line_comment_start_length);
+				previous_highlight = HIGHLIGHT_MULTILINE_COMMENT;
 				i += multi_line_comment_start_length;
 				in_comment = 1;
 				continue;
 			}
 		}
 
-		if (editor->syntax->flags & HIGHLIGHT_FLAG_STRINGS) {
+		if (syntax->flags & HIGHLIGHT_FLAG_STRINGS) {
 			if (in_string) {
-				line->highlight[i] = HIGHLIGHT_STRING;
+				mark(highlight, i, HIGHLIGHT_STRING, 1);
+				previous_highlight = HIGHLIGHT_STRING;
 
-				if (c == '\\' && i + 1 < line->render_size) {
-					line->highlight[i + 1] = HIGHLIGHT_STRING;
+				if (c == '\\' && i + 1 < size) {
+					mark(highlight, i + 1, HIGHLIGHT_STRING, 1);
 					i += 2;
 					continue;
 				}
@@ -107,16 +177,18 @@ void editor_update_syntax(struct editor_state *editor, line_t *line)
 			} else {
 				if (c == '"' || c == '\'') {
 					in_string = c;
-					line->highlight[i] = HIGHLIGHT_STRING;
+					mark(highlight, i, HIGHLIGHT_STRING, 1);
+					previous_highlight = HIGHLIGHT_STRING;
 					i++;
 					continue;
 				}
 			}
 		}
 
-		if (editor->syntax->flags & HIGHLIGHT_FLAG_NUMBERS) {
+		if (syntax->flags & HIGHLIGHT_FLAG_NUMBERS) {
 			if ((isdigit(c) && (previous_separator || previous_highlight == HIGHLIGHT_NUMBER)) || (c == '.' && previous_highlight == HIGHLIGHT_NUMBER)) {
-				line->highlight[i] = HIGHLIGHT_NUMBER;
+				mark(highlight, i, HIGHLIGHT_NUMBER, 1);
+				previous_highlight = HIGHLIGHT_NUMBER;
 				i++;
 				previous_separator = 0;
 				continue;
@@ -124,34 +196,39 @@ void editor_update_syntax(struct editor_state *editor, line_t *line)
 		}
 
 		if (previous_separator) {
-			int j;
-			for (j = 0; keywords[j]; j++) {
-				int keyword_length = strlen(keywords[j]);
-				int is_secondary = keywords[j][keyword_length - 1] == '|';
-
-				if (is_secondary)
-					keyword_length--;
-
-				if (!strncmp(&line->render[i], keywords[j], keyword_length) && is_separator(line->render[i + keyword_length])) {
-					memset(&line->highlight[i], is_secondary ? HIGHLIGHT_KEYWORD2 : HIGHLIGHT_KEYWORD1, keyword_length);
-					i += keyword_length;
-					break;
-				}
-			}
-			if (keywords[j] != NULL) {
+			int type;
+			int keyword_length = match_keyword(syntax->keyword_trie, text, size, i, &type);
+			if (keyword_length > 0) {
+				mark(highlight, i, type, keyword_length);
+				previous_highlight = type;
+				i += keyword_length;
 				previous_separator = 0;
 				continue;
 			}
 		}
 
 		previous_separator = is_separator(c);
+		previous_highlight = HIGHLIGHT_NORMAL;
 		i++;
 	}
 
-	int changed = (line->highlight_open_comment != in_comment);
-	line->highlight_open_comment = in_comment;
-	if (changed && line->index + 1 < editor->num_lines)
-		editor_update_syntax(editor, &editor->lines[line->index + 1]);
+	return in_comment;
+}
+
+/*
+ * Mark a line as needing to be highlighted again. The highlighting thread
+ * picks it up once the frontier reaches it.
+ */
+void editor_update_syntax(struct editor_state *editor, line_t *line)
+{
+	line->highlight_dirty = 1;
+	editor_invalidate_syntax(editor, document_index_of(&editor->document, line));
+}
+
+void editor_invalidate_syntax(struct editor_state *editor, int from)
+{
+	if (from < editor->highlight_frontier)
+		editor->highlight_frontier = from;
 }
 
 int editor_syntax_to_colour(int highlight)
@@ -168,14 +245,10 @@ int editor_syntax_to_colour(int highlight)
 	}
 }
 
-void editor_select_syntax_highlight(struct editor_state* editor)
+/* Find the syntax for a file from its name. This only reads the rules, so any thread can use it. */
+struct editor_syntax *syntax_find(const char *filename)
 {
-	editor->syntax = NULL;
-	
-	if (editor->filename == NULL)
-		return;
-
-	char* extension = strrchr(editor->filename, '.');
+	const char* extension = strrchr(filename, '.');
 
 	for (unsigned int j = 0; j < HIGHLIGHT_DATABASE_ENTRY_COUNT; j++) {
 		struct editor_syntax* syntax = &highlight_database[j];
@@ -183,15 +256,28 @@ void editor_select_syntax_highlight(struct editor_state* editor)
 
 		while (syntax->filetype_match[i]) {
 			int is_extension = (syntax->filetype_match[i][0] == '.');
-			if ((is_extension && extension && !strcmp(extension, syntax->filetype_match[i])) || (!is_extension && strstr(editor->filename, syntax->filetype_match[i]))) {
-				editor->syntax = syntax;
-
-				for (int line = 0; line < editor->num_lines; line++)
-					editor_update_syntax(editor, &editor->lines[line]);
-				
-				return;
-			}
+			if ((is_extension && extension && !strcmp(extension, syntax->filetype_match[i])) || (!is_extension && strstr(filename, syntax->filetype_match[i])))
+				return syntax;
 			i++;
 		}
 	}
+	return NULL;
+}
+
+void editor_select_syntax_highlight(struct editor_state* editor)
+{
+	editor->syntax = NULL;
+
+	/* Every line has to be highlighted again with the new rules. */
+	for (int line = 0; line < editor->num_lines; line++)
+		document_get(&editor->document, line)->highlight_dirty = 1;
+	editor_invalidate_syntax(editor, 0);
+	
+	if (editor->filename == NULL)
+		return;
+
+	struct editor_syntax* syntax = syntax_find(editor->filename);
+	if (syntax != NULL && syntax->keyword_trie == NULL)
+		syntax->keyword_trie = compile_keywords(syntax->keywords);
+	editor->syntax = syntax;
 }
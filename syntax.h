@@ -9,6 +9,21 @@
 #define HIGHLIGHT_FLAG_NUMBERS (1 << 0)
 #define HIGHLIGHT_FLAG_STRINGS (1 << 1)
 
+/* Keywords are made of ASCII characters only. */
+#define KEYWORD_ALPHABET_SIZE 128
+
+/*
+ * The keywords of a syntax compiled into a trie, so that the keyword at some
+ * position can be found by reading each character once.
+ */
+struct keyword_trie {
+	int num_nodes;
+	/* The node reached from each node by each character, or 0 for none. */
+	unsigned short (*next)[KEYWORD_ALPHABET_SIZE];
+	/* The highlight of the keyword that ends at each node, if any. */
+	unsigned char *keyword_type;
+};
+
 struct editor_syntax {
 	char* filetype;
 	char** filetype_match;
@@ -17,6 +32,8 @@ struct editor_syntax {
 	char* multi_line_comment_start;
 	char* multi_line_comment_end;
 	int flags;
+	/* Built from the keywords when the syntax is first selected. */
+	struct keyword_trie* keyword_trie;
 };
 
 enum editor_highlight {
@@ -32,8 +49,22 @@ enum editor_highlight {
 
 #define HIGHLIGHT_DATABASE_ENTRY_COUNT (sizeof(highlight_database) / sizeof(highlight_database[0]))
 
+/*
+ * Highlight a line of text, starting inside a multi-line comment if in_comment
+ * is set. The highlight array may be NULL when only the state at the end of
+ * the line is needed. Returns whether the line ends inside a multi-line
+ * comment. This only reads the syntax rules, so it is safe to call from the
+ * highlighting thread.
+ */
+int syntax_highlight_text(struct editor_syntax*, const char *text, int size, unsigned char *highlight, int in_comment);
+
 void editor_update_syntax(struct editor_state* editor, line_t*);
+
+/* Mark the highlighting of every line from the given one onwards as suspect. */
+void editor_invalidate_syntax(struct editor_state* editor, int from);
+
 int editor_syntax_to_colour(int highlight);
+struct editor_syntax *syntax_find(const char *filename);
 void editor_select_syntax_highlight(struct editor_state* editor);
 
 #endif
@@ -0,0 +1,74 @@
+/*
+ * tests/undo.c: Check that loading a file leaves nothing to undo.
+ *
+ * Files that can not be mapped, such as pipes, are read a line at a time and
+ * inserted into the document like edits. Undoing right after opening one must
+ * not take its lines away again. The file is a FIFO that a child writes to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../editor.h"
+#include "../file.h"
+#include "../undo.h"
+
+#define LINES 59
+
+static int failures = 0;
+
+static void check(int condition, const char *what)
+{
+	if (!condition) {
+		fprintf(stderr, "FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	char directory[] = "/tmp/glypher-test-XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_CACHE_HOME", directory, 1);
+
+	char path[sizeof(directory) + 16];
+	snprintf(path, sizeof(path), "%s/fifo", directory);
+	if (mkfifo(path, 0600) == -1) {
+		perror("mkfifo");
+		return 1;
+	}
+
+	pid_t writer = fork();
+	if (writer == 0) {
+		FILE *fp = fopen(path, "w");
+		for (int i = 0; i < LINES; i++)
+			fprintf(fp, "line %d\n", i);
+		fclose(fp);
+		_exit(0);
+	}
+
+	struct editor_state editor;
+	init_editor(&editor);
+	editor_open(&editor, path);
+	waitpid(writer, NULL, 0);
+
+	check(editor.num_lines == LINES, "all lines of the pipe are loaded");
+	check(!editor.dirty, "the file is not modified after loading");
+	check(!editor_undo(&editor), "there is nothing to undo after loading");
+	check(editor.num_lines == LINES, "undoing keeps the lines that were loaded");
+	check(!editor.dirty, "undoing does not modify the file");
+
+	editor_destroy(&editor);
+	unlink(path);
+	rmdir(directory);
+
+	if (failures == 0)
+		printf("All tests passed\n");
+	return failures != 0;
+}
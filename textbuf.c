@@ -1,5 +1,7 @@
 #include "textbuf.h"
 
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,35 +12,84 @@ struct textbuf textbuf_init()
 	struct textbuf result;
 	result.buffer = NULL;
 	result.length = 0;
+	result.capacity = 0;
 	return result;
 }
 
-void textbuf_append(struct textbuf *textbuf, const char *str, int len)
+/* Make room for some more text, doubling the buffer so appending is not a reallocation each time. */
+void textbuf_reserve(struct textbuf *textbuf, size_t extra)
 {
-	char *new = realloc(textbuf->buffer, textbuf->length + len);
+	if (textbuf->length + extra <= textbuf->capacity)
+		return;
+
+	size_t capacity = textbuf->capacity ? textbuf->capacity * 2 : 64;
+	while (capacity < textbuf->length + extra)
+		capacity *= 2;
+
+	char *new = realloc(textbuf->buffer, capacity);
 	if (new == NULL) {
 		fatal_error("Failed to reallocate textbuf!");
 		return;
 	}
 
-	memcpy(&new[textbuf->length], str, len);
 	textbuf->buffer = new;
+	textbuf->capacity = capacity;
+}
+
+void textbuf_append(struct textbuf *textbuf, const char *str, int len)
+{
+	if (len <= 0)
+		return;
+
+	textbuf_reserve(textbuf, len);
+	memcpy(&textbuf->buffer[textbuf->length], str, len);
 	textbuf->length += len;
 }
 
+/* Append a character a number of times, such as spaces to pad to a column. */
+void textbuf_fill(struct textbuf *textbuf, char c, int count)
+{
+	if (count <= 0)
+		return;
+
+	textbuf_reserve(textbuf, count);
+	memset(&textbuf->buffer[textbuf->length], c, count);
+	textbuf->length += count;
+}
+
+/* Append formatted text, without its terminating NUL. */
+void textbuf_printf(struct textbuf *textbuf, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (length <= 0)
+		return;
+
+	/* vsnprintf always writes the NUL, which is left outside the text. */
+	textbuf_reserve(textbuf, length + 1);
+	va_start(args, format);
+	vsnprintf(&textbuf->buffer[textbuf->length], length + 1, format, args);
+	va_end(args);
+	textbuf->length += length;
+}
+
+/* Remove the last character, if there is one. */
 void textbuf_delete(struct textbuf *textbuf)
 {
-	textbuf->buffer[textbuf->length] = '\0';
-	textbuf->length--;
+	if (textbuf->length > 0)
+		textbuf->length--;
 }
 
+/* Empty the buffer, keeping its memory to be filled again. */
 void textbuf_clear(struct textbuf *textbuf)
 {
-	textbuf_free(textbuf);
-	*textbuf = textbuf_init();
+	textbuf->length = 0;
 }
 
 void textbuf_free(struct textbuf *textbuf)
 {
 	free(textbuf->buffer);
+	*textbuf = textbuf_init();
 }
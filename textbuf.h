@@ -2,7 +2,9 @@
  * textbuf.h: A simple dynamic text buffer.
  *
  * This file provides the `textbuf` struct, which is a dynamically allocated
- * buffer of text.
+ * buffer of text. The buffer grows geometrically and keeps its memory when it
+ * is cleared, so a buffer that is filled again every frame stops allocating
+ * once it is large enough.
  */
 
 #ifndef _BUFFER_H
@@ -13,10 +15,14 @@
 struct textbuf {
 	char  *buffer;
 	size_t length;
+	size_t capacity;
 };
 
 struct textbuf textbuf_init();
+void textbuf_reserve(struct textbuf *textbuf, size_t extra);
 void textbuf_append(struct textbuf *textbuf, const char *str, int len);
+void textbuf_fill(struct textbuf *textbuf, char c, int count);
+void textbuf_printf(struct textbuf *textbuf, const char *format, ...);
 void textbuf_delete(struct textbuf *textbuf);
 void textbuf_clear(struct textbuf *textbuf);
 void textbuf_free(struct textbuf *textbuf);
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Times are counted in microseconds. Below 16 each has its own bucket, and
+ * above that every power of two is split into 8, so a bucket is never more
+ * than an eighth wider than the times in it.
+ */
+#define EXACT_BUCKETS 16
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_EXPONENT 40
+#define NUM_BUCKETS (EXACT_BUCKETS + (MAX_EXPONENT - 4) * SUB_BUCKETS)
+
+struct histogram {
+	long long buckets[NUM_BUCKETS];
+	long long count;
+	long long total;
+	long long max;
+};
+
+static const char *stage_names[TRACE_NUM_STAGES] = {
+	[TRACE_EDIT] = "edit",
+	[TRACE_HIGHLIGHT] = "highlight",
+	[TRACE_DRAW] = "draw",
+	[TRACE_PRESENT] = "present",
+	[TRACE_INPUT] = "input",
+};
+
+static struct histogram histograms[TRACE_NUM_STAGES];
+
+/* When the oldest input that has not been shown arrived, or zero if it all has. */
+static long long input_time = 0;
+
+long long trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bucket_index(long long microseconds)
+{
+	if (microseconds < EXACT_BUCKETS)
+		return microseconds;
+
+	int exponent = 4;
+	while (exponent < MAX_EXPONENT - 1 && microseconds >> (exponent + 1) != 0)
+		exponent++;
+	int sub_bucket = (microseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+	return EXACT_BUCKETS + (exponent - 4) * SUB_BUCKETS + sub_bucket;
+}
+
+/* The largest time that goes in a bucket. */
+static long long bucket_limit(int index)
+{
+	if (index < EXACT_BUCKETS)
+		return index;
+
+	int exponent = 4 + (index - EXACT_BUCKETS) / SUB_BUCKETS;
+	int sub_bucket = (index - EXACT_BUCKETS) % SUB_BUCKETS;
+	return ((long long)(SUB_BUCKETS + sub_bucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+void trace_record(enum trace_stage stage, long long start)
+{
+	long long microseconds = (trace_now() - start) / 1000;
+	struct histogram *histogram = &histograms[stage];
+
+	histogram->buckets[bucket_index(microseconds)]++;
+	histogram->count++;
+	histogram->total += microseconds;
+	if (microseconds > histogram->max)
+		histogram->max = microseconds;
+}
+
+void trace_input_arrived(void)
+{
+	if (input_time == 0)
+		input_time = trace_now();
+}
+
+void trace_input_shown(void)
+{
+	if (input_time == 0)
+		return;
+	trace_record(TRACE_INPUT, input_time);
+	input_time = 0;
+}
+
+/* The time that a given share of the times, out of a thousand, are no longer than. */
+static long long percentile(struct histogram *histogram, int per_mille)
+{
+	long long wanted = (histogram->count * per_mille + 999) / 1000;
+	long long seen = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= wanted && seen > 0)
+			return bucket_limit(i) < histogram->max ? bucket_limit(i) : histogram->max;
+	}
+	return histogram->max;
+}
+
+int trace_format_header(char *buffer, size_t size)
+{
+	return snprintf(buffer, size, "%-9s %8s %8s %8s %8s %8s", "stage", "count", "mean ms", "p50 ms", "p99 ms", "max ms");
+}
+
+int trace_format_stage(enum trace_stage stage, char *buffer, size_t size)
+{
+	struct histogram *histogram = &histograms[stage];
+	double mean = histogram->count ? (double)histogram->total / histogram->count : 0;
+	return snprintf(buffer, size, "%-9s %8lld %8.2f %8.2f %8.2f %8.2f", stage_names[stage], histogram->count,
+			mean / 1e3, percentile(histogram, 500) / 1e3, percentile(histogram, 990) / 1e3, histogram->max / 1e3);
+}
+
+/* Write out the summary and every bucket that was used, if GLYPHER_TRACE names a file. */
+void trace_dump(void)
+{
+	const char *path = getenv("GLYPHER_TRACE");
+	if (path == NULL || path[0] == '\0')
+		return;
+
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		return;
+	}
+
+	char line[128];
+	trace_format_header(line, sizeof(line));
+	fprintf(fp, "%s\n", line);
+	for (int stage = 0; stage < TRACE_NUM_STAGES; stage++) {
+		trace_format_stage(stage, line, sizeof(line));
+		fprintf(fp, "%s\n", line);
+	}
+
+	for (int stage = 0; stage < TRACE_NUM_STAGES; stage++) {
+		fprintf(fp, "\n%s: microseconds, count\n", stage_names[stage]);
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			if (histograms[stage].buckets[i] == 0)
+				continue;
+			long long low = i > 0 ? bucket_limit(i - 1) + 1 : 0;
+			fprintf(fp, "%lld-%lld %lld\n", low, bucket_limit(i), histograms[stage].buckets[i]);
+		}
+	}
+
+	fclose(fp);
+}
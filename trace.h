@@ -0,0 +1,40 @@
+/*
+ * trace.h: Timing each stage between a key being pressed and it being shown.
+ *
+ * The times of every stage are kept in a histogram, which can be shown over
+ * the text by pressing F12. If GLYPHER_TRACE names a file, the histograms are
+ * written to it when the editor exits.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+
+enum trace_stage {
+	/* Applying a key or some typed text to the editor. */
+	TRACE_EDIT,
+	/* Handing lines to the highlighting thread and applying what it sends back. */
+	TRACE_HIGHLIGHT,
+	/* Drawing the rows and status bar that changed. */
+	TRACE_DRAW,
+	/* SDL_RenderPresent. */
+	TRACE_PRESENT,
+	/* From an input event arriving to the frame that shows it. */
+	TRACE_INPUT,
+	TRACE_NUM_STAGES
+};
+
+/* A monotonic time in nanoseconds, to pass to trace_record when a stage ends. */
+long long trace_now(void);
+void trace_record(enum trace_stage stage, long long start);
+
+/* Input latency is measured from the first event that has not been shown yet, until it is. */
+void trace_input_arrived(void);
+void trace_input_shown(void);
+
+int trace_format_header(char *buffer, size_t size);
+int trace_format_stage(enum trace_stage stage, char *buffer, size_t size);
+void trace_dump(void);
+
+#endif
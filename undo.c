@@ -0,0 +1,330 @@
+#include "undo.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "editor.h"
+#include "error.h"
+#include "line.h"
+
+enum undo_type {
+	UNDO_INSERT_TEXT,
+	UNDO_DELETE_TEXT,
+	UNDO_INSERT_LINE,
+	UNDO_DELETE_LINE
+};
+
+/* An operation in the log, which is followed by the text it inserted or deleted. */
+struct undo_record {
+	unsigned char type;
+	unsigned char starts_change;
+	int line;
+	int x;
+	int length;
+	/* The size of the operation before this one, to walk back through the log, or zero for the first. */
+	int previous_size;
+};
+
+/* Operations are packed together with their text, so they are copied in and out rather than aligned. */
+static struct undo_record read_record(struct undo_log *log, size_t offset)
+{
+	struct undo_record record;
+	memcpy(&record, &log->data[offset], sizeof(record));
+	return record;
+}
+
+static void write_record(struct undo_log *log, size_t offset, struct undo_record *record)
+{
+	memcpy(&log->data[offset], record, sizeof(*record));
+}
+
+static size_t record_size(struct undo_record *record)
+{
+	return sizeof(*record) + record->length;
+}
+
+void undo_init(struct undo_log *log)
+{
+	log->data = NULL;
+	log->size = 0;
+	log->capacity = 0;
+	log->position = 0;
+	log->last = -1;
+	log->start_change = 1;
+	log->overflowed = 0;
+	log->replaying = 0;
+
+	log->limit = UNDO_DEFAULT_LIMIT;
+	const char *limit = getenv("GLYPHER_UNDO_LIMIT");
+	if (limit != NULL && atol(limit) > 0)
+		log->limit = (size_t)atol(limit) << 20;
+}
+
+void undo_free(struct undo_log *log)
+{
+	free(log->data);
+	log->data = NULL;
+	log->size = log->capacity = log->position = 0;
+	log->last = -1;
+}
+
+/* Make the next operation start a change that is undone on its own. */
+void undo_start_change(struct undo_log *log)
+{
+	log->start_change = 1;
+	log->overflowed = 0;
+}
+
+static void reserve(struct undo_log *log, size_t amount)
+{
+	if (log->size + amount <= log->capacity)
+		return;
+
+	size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+	while (capacity < log->size + amount)
+		capacity *= 2;
+	if (capacity > log->limit && log->size + amount <= log->limit)
+		capacity = log->limit;
+
+	log->data = realloc(log->data, capacity);
+	if (log->data == NULL)
+		fatal_error("Failed to grow the undo log to %zu bytes\n", capacity);
+	log->capacity = capacity;
+}
+
+/*
+ * Forget the oldest changes until some more bytes fit under the limit. If the
+ * change being made is too large by itself, it is forgotten as well and
+ * nothing more is recorded until the next change. Returns zero in that case.
+ */
+static int make_room(struct undo_log *log, size_t amount)
+{
+	if (log->size + amount <= log->limit)
+		return 1;
+
+	/* Forget at least a quarter of the log at a time, so this is not done for every operation. */
+	size_t wanted = log->size + amount - log->limit;
+	if (wanted < log->limit / 4)
+		wanted = log->limit / 4;
+
+	size_t cut = 0;
+	size_t offset = 0;
+	while (offset < log->size) {
+		struct undo_record record = read_record(log, offset);
+		if (record.starts_change && offset >= wanted) {
+			cut = offset;
+			break;
+		}
+		offset += record_size(&record);
+	}
+	if (cut == 0 && log->start_change && amount <= log->limit)
+		cut = log->size;
+
+	if (cut == 0) {
+		log->size = log->position = 0;
+		log->last = -1;
+		log->overflowed = 1;
+		return 0;
+	}
+
+	memmove(log->data, &log->data[cut], log->size - cut);
+	log->size -= cut;
+	log->position -= cut;
+	log->last -= cut;
+	if (log->size > 0) {
+		struct undo_record first = read_record(log, 0);
+		first.previous_size = 0;
+		write_record(log, 0, &first);
+	}
+	return 1;
+}
+
+static void add_record(struct undo_log *log, int type, int line, int x, const char *text, size_t length)
+{
+	struct undo_record record;
+	if (!make_room(log, sizeof(record) + length))
+		return;
+	reserve(log, sizeof(record) + length);
+
+	record.type = type;
+	record.starts_change = log->start_change;
+	record.line = line;
+	record.x = x;
+	record.length = length;
+	record.previous_size = log->last >= 0 ? log->size - log->last : 0;
+
+	write_record(log, log->size, &record);
+	memcpy(&log->data[log->size + sizeof(record)], text, length);
+
+	log->last = log->size;
+	log->size += record_size(&record);
+	log->position = log->size;
+	log->start_change = 0;
+}
+
+/*
+ * Add to the last operation instead of making a new one, if it is of the same
+ * type and ends where this one starts. This keeps a run of typing, or of
+ * backspacing, as a single operation.
+ */
+static int extend_record(struct undo_log *log, int type, int line, int x, const char *text, size_t length)
+{
+	if (log->start_change || log->last < 0 || log->size + length > log->limit)
+		return 0;
+
+	struct undo_record record = read_record(log, log->last);
+	if (record.type != type || record.line != line)
+		return 0;
+
+	char *record_text = &log->data[log->last + sizeof(record)];
+	if (type == UNDO_INSERT_TEXT && x == record.x + record.length) {
+		reserve(log, length);
+		record_text = &log->data[log->last + sizeof(record)];
+		memcpy(&record_text[record.length], text, length);
+	} else if (type == UNDO_DELETE_TEXT && x == record.x) {
+		reserve(log, length);
+		record_text = &log->data[log->last + sizeof(record)];
+		memcpy(&record_text[record.length], text, length);
+	} else if (type == UNDO_DELETE_TEXT && x + (int)length == record.x) {
+		reserve(log, length);
+		record_text = &log->data[log->last + sizeof(record)];
+		memmove(&record_text[length], record_text, record.length);
+		memcpy(record_text, text, length);
+		record.x = x;
+	} else {
+		return 0;
+	}
+
+	record.length += length;
+	write_record(log, log->last, &record);
+	log->size += length;
+	log->position = log->size;
+	return 1;
+}
+
+static void record_operation(struct undo_log *log, int type, int line, int x, const char *text, size_t length)
+{
+	if (log->replaying)
+		return;
+
+	/* Changes that were undone can not be redone once something else has changed. */
+	log->size = log->position;
+	if (log->overflowed)
+		return;
+
+	if (!extend_record(log, type, line, x, text, length))
+		add_record(log, type, line, x, text, length);
+}
+
+void undo_record_insert_text(struct undo_log *log, int line, int x, const char *text, size_t length)
+{
+	record_operation(log, UNDO_INSERT_TEXT, line, x, text, length);
+}
+
+void undo_record_delete_text(struct undo_log *log, int line, int x, const char *text, size_t length)
+{
+	record_operation(log, UNDO_DELETE_TEXT, line, x, text, length);
+}
+
+void undo_record_insert_line(struct undo_log *log, int at, const char *text, size_t length)
+{
+	record_operation(log, UNDO_INSERT_LINE, at, 0, text, length);
+}
+
+void undo_record_delete_line(struct undo_log *log, int at, const char *text, size_t length)
+{
+	record_operation(log, UNDO_DELETE_LINE, at, 0, text, length);
+}
+
+/* Do an operation again, or do the opposite of it to undo it. */
+static void replay(struct editor_state *editor, struct undo_record *record, char *text, int undoing)
+{
+	int type = record->type;
+	if (undoing) {
+		static const int opposites[] = {
+			[UNDO_INSERT_TEXT] = UNDO_DELETE_TEXT,
+			[UNDO_DELETE_TEXT] = UNDO_INSERT_TEXT,
+			[UNDO_INSERT_LINE] = UNDO_DELETE_LINE,
+			[UNDO_DELETE_LINE] = UNDO_INSERT_LINE,
+		};
+		type = opposites[type];
+	}
+
+	switch (type) {
+	case UNDO_INSERT_TEXT:
+		line_insert_string(editor, document_get(&editor->document, record->line), record->x, text, record->length);
+		break;
+	case UNDO_DELETE_TEXT:
+		line_delete_string(editor, document_get(&editor->document, record->line), record->x, record->length);
+		break;
+	case UNDO_INSERT_LINE:
+		editor_insert_line(editor, record->line, text, record->length);
+		break;
+	case UNDO_DELETE_LINE:
+		editor_delete_line(editor, record->line);
+		break;
+	}
+
+	editor->cursor_y = record->line;
+	editor->cursor_x = record->x;
+}
+
+/* Keep the cursor inside the document after lines have come and gone. */
+static void clamp_cursor(struct editor_state *editor)
+{
+	if (editor->cursor_y >= editor->num_lines)
+		editor->cursor_y = editor->num_lines > 0 ? editor->num_lines - 1 : 0;
+
+	int size = editor->cursor_y < editor->num_lines ? document_get(&editor->document, editor->cursor_y)->size : 0;
+	if (editor->cursor_x > size)
+		editor->cursor_x = size;
+}
+
+/* Undo the last change, in the opposite order to how its operations were made. */
+int editor_undo(struct editor_state *editor)
+{
+	struct undo_log *log = &editor->undo;
+	if (log->last < 0) {
+		editor_set_status_message(editor, "Nothing to undo");
+		return 0;
+	}
+
+	log->replaying = 1;
+	for (;;) {
+		struct undo_record record = read_record(log, log->last);
+		replay(editor, &record, &log->data[log->last + sizeof(record)], 1);
+
+		log->position = log->last;
+		log->last = record.previous_size ? log->last - record.previous_size : -1;
+		if (record.starts_change || log->last < 0)
+			break;
+	}
+	log->replaying = 0;
+	log->start_change = 1;
+
+	clamp_cursor(editor);
+	return 1;
+}
+
+int editor_redo(struct editor_state *editor)
+{
+	struct undo_log *log = &editor->undo;
+	if (log->position >= log->size) {
+		editor_set_status_message(editor, "Nothing to redo");
+		return 0;
+	}
+
+	log->replaying = 1;
+	do {
+		struct undo_record record = read_record(log, log->position);
+		replay(editor, &record, &log->data[log->position + sizeof(record)], 0);
+
+		log->last = log->position;
+		log->position += record_size(&record);
+	} while (log->position < log->size && !read_record(log, log->position).starts_change);
+	log->replaying = 0;
+	log->start_change = 1;
+
+	clamp_cursor(editor);
+	return 1;
+}
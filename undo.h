@@ -0,0 +1,49 @@
+/*
+ * undo.h: Undoing and redoing changes to the document.
+ *
+ * Every edit is recorded as a small operation with the text it added or
+ * removed, one after another in a single buffer. Edits made for one command,
+ * such as everything typed in insert mode, form a change that is undone and
+ * redone together, and typing a run of characters makes a single operation.
+ */
+
+#ifndef _UNDO_H
+#define _UNDO_H
+
+#include <stddef.h>
+
+/* How much memory the log may use, unless GLYPHER_UNDO_LIMIT gives a number of megabytes. */
+#define UNDO_DEFAULT_LIMIT (64 << 20)
+
+struct editor_state;
+
+struct undo_log {
+	char *data;
+	size_t size;
+	size_t capacity;
+	size_t limit;
+	/* Operations before this have been done, and the ones after it undone. */
+	size_t position;
+	/* Where the operation that ends at position starts, or -1 if there is none. */
+	long last;
+	/* Set when the next operation starts a new change. */
+	int start_change;
+	/* Set while the current change is too large to keep, so nothing is recorded until the next one. */
+	int overflowed;
+	/* Set while undoing or redoing, or loading a file, so those edits are not recorded. */
+	int replaying;
+};
+
+void undo_init(struct undo_log *);
+void undo_free(struct undo_log *);
+void undo_start_change(struct undo_log *);
+
+void undo_record_insert_text(struct undo_log *, int line, int x, const char *text, size_t length);
+void undo_record_delete_text(struct undo_log *, int line, int x, const char *text, size_t length);
+void undo_record_insert_line(struct undo_log *, int at, const char *text, size_t length);
+void undo_record_delete_line(struct undo_log *, int at, const char *text, size_t length);
+
+int editor_undo(struct editor_state *);
+int editor_redo(struct editor_state *);
+
+#endif
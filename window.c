@@ -1,5 +1,6 @@
 #include "window.h"
 
+#include <string.h>
 #include <unistd.h>
 #include <SDL2/SDL.h>
 
@@ -7,17 +8,103 @@
 #include "editor.h"
 #include "error.h"
 #include "font.h"
+#include "highlight.h"
 #include "input.h"
+#include "journal.h"
 #include "syntax.h"
+#include "trace.h"
 
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
-static SDL_Texture *font_texture = NULL;
 
 static int window_width;
 static int window_height;
 
 static PSFFont font;
+static struct glyph_atlas atlas;
+
+/*
+ * The glyphs of a frame are collected into one list of textured, coloured
+ * quads, and drawn with a single call at the end of the frame.
+ */
+static SDL_Vertex *glyph_vertices = NULL;
+static int *glyph_indices = NULL;
+static int num_glyphs = 0;
+static int glyph_capacity = 0;
+
+/*
+ * The text and the status bar are kept in this texture between frames, so
+ * that only the rows that have changed are drawn again. Each frame copies it
+ * to the window and draws the cursor on top.
+ */
+static SDL_Texture *text_layer = NULL;
+static int text_layer_valid = 0;
+
+/* What the last frame showed, to tell what has changed since. */
+static int drawn_line_offset;
+static int drawn_col_offset;
+static int drawn_cursor_x = -1;
+static int drawn_cursor_y = -1;
+static struct textbuf drawn_status;
+/* The status being built for this frame, which swaps with drawn_status, so neither is allocated again. */
+static struct textbuf frame_status;
+static int needs_present = 1;
+
+/* Whether the latency of each stage is shown over the text. */
+static int show_trace = 0;
+
+/* Text input that has arrived since the last frame, to be inserted all at once. */
+static struct textbuf pending_text;
+
+/* Frames are paced to the refresh rate of the display, or this if it is not known. */
+#define DEFAULT_REFRESH_RATE 60
+static Uint32 frame_interval;
+static Uint32 last_present_time = 0;
+
+/* Highlighting of the row being drawn, with search matches marked on top. */
+static unsigned char *row_highlight = NULL;
+static struct highlight_span *row_spans = NULL;
+static size_t row_highlight_capacity = 0;
+
+/* Pushed by the highlighting thread when it has finished some lines. */
+static Uint32 highlight_event;
+
+static void notify_highlight(void)
+{
+	SDL_Event event = { 0 };
+	event.type = highlight_event;
+	SDL_PushEvent(&event);
+}
+
+/*
+ * Make a new text layer the size of the window. Without support for render
+ * targets, everything is drawn straight to the window on every frame instead.
+ */
+static void create_text_layer(void)
+{
+	if (text_layer != NULL)
+		SDL_DestroyTexture(text_layer);
+	text_layer = NULL;
+	text_layer_valid = 0;
+
+	if (!SDL_RenderTargetSupported(renderer))
+		return;
+
+	text_layer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, window_width, window_height);
+	if (text_layer == NULL)
+		warning(SDL_GetError());
+}
+
+/* Frames are drawn no more often than the display they are on refreshes. */
+static void update_frame_interval(void)
+{
+	SDL_DisplayMode mode;
+	int display = SDL_GetWindowDisplayIndex(window);
+	int refresh_rate = DEFAULT_REFRESH_RATE;
+	if (display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0)
+		refresh_rate = mode.refresh_rate;
+	frame_interval = 1000 / refresh_rate;
+}
 
 void window_init(const char *title, int rows, int cols)
 {
@@ -36,123 +123,408 @@ void window_init(const char *title, int rows, int cols)
 	if (renderer == NULL)
 		fatal_error("Failed to create renderer: %s\n", SDL_GetError());
 
-	font_texture = font_create_texture(renderer, &font);
+	atlas = font_create_atlas(renderer, &font);
+
+	create_text_layer();
+	drawn_status = textbuf_init();
+	frame_status = textbuf_init();
+	pending_text = textbuf_init();
+	update_frame_interval();
+
+	highlight_event = SDL_RegisterEvents(1);
+	highlight_start(notify_highlight);
 
 	SDL_ShowWindow(window);
 }
 
-int window_handle_event(struct editor_state *editor)
+/* Keys can move the cursor by a screenful, so the editor is told the size before any event is handled. */
+static void update_screen_size(struct editor_state *editor)
 {
-	static SDL_Event e;
-	SDL_WaitEvent(&e);
-	switch (e.type) {
+	editor_set_screen_size(editor, window_height / font.height, window_width / font.width);
+}
+
+/* Apply the text that has been typed since the last event of another kind. */
+static void flush_text(struct editor_state *editor)
+{
+	if (pending_text.length == 0)
+		return;
+
+	long long start = trace_now();
+	input_process_textinput(editor, pending_text.buffer, pending_text.length);
+	trace_record(TRACE_EDIT, start);
+	textbuf_clear(&pending_text);
+}
+
+static int handle_event(struct editor_state *editor, SDL_Event *e)
+{
+	/* Typing is gathered up, and applied before anything that might depend on it. */
+	if (e->type == SDL_TEXTINPUT) {
+		trace_input_arrived();
+		textbuf_append(&pending_text, e->text.text, strlen(e->text.text));
+		return 1;
+	}
+	flush_text(editor);
+
+	long long start = trace_now();
+	if (e->type == highlight_event) {
+		editor_collect_highlight(editor);
+		trace_record(TRACE_HIGHLIGHT, start);
+		return 1;
+	}
+
+	switch (e->type) {
 	case SDL_QUIT:
 		return 0;
 	case SDL_KEYDOWN:
-		editor_process_keypress(editor, &e.key.keysym);
-		break;
-	case SDL_TEXTINPUT:
-		input_process_textinput(editor, e.text.text);
+		trace_input_arrived();
+		if (e->key.keysym.sym == SDLK_F12) {
+			show_trace = !show_trace;
+			needs_present = 1;
+			break;
+		}
+		editor_process_keypress(editor, &e->key.keysym);
+		trace_record(TRACE_EDIT, start);
 		break;
 	case SDL_WINDOWEVENT:
-		if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+		if (e->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
 			SDL_GetWindowSize(window, &window_width, &window_height);
-			editor_update_screen_size(editor);
+			update_screen_size(editor);
+			create_text_layer();
+		} else if (e->window.event == SDL_WINDOWEVENT_EXPOSED) {
+			needs_present = 1;
+		} else if (e->window.event == SDL_WINDOWEVENT_MOVED) {
+			update_frame_interval();
 		}
 		break;
+	case SDL_RENDER_TARGETS_RESET:
+	case SDL_RENDER_DEVICE_RESET:
+		/* The contents of the text layer have been lost. */
+		text_layer_valid = 0;
+		break;
 	}
 	return 1;
 }
 
-static void draw_string(const char *str, const uint8_t *highlight, size_t len, int x, int y)
+/*
+ * Wait for an event, then handle every event that comes in until it is time
+ * to draw the next frame. If a frame was drawn less than a refresh ago, events
+ * are gathered until the refresh is over, so a burst of typing or key repeats
+ * is drawn once per refresh instead of once per event. Returns zero when the
+ * window is closed.
+ */
+int window_handle_events(struct editor_state *editor)
 {
-	SDL_Rect dstrect = { x, y, font.width, font.height };
-	SDL_Rect srcrect = { 0, 0, font.width, font.height };
-	int current_colour = 0xffffff;
+	SDL_Event e;
+	SDL_WaitEvent(&e);
+	update_screen_size(editor);
+
+	for (;;) {
+		if (!handle_event(editor, &e) || editor->quit)
+			return 0;
+		if (SDL_PollEvent(&e))
+			continue;
+
+		Sint32 wait = (Sint32)(last_present_time + frame_interval - SDL_GetTicks());
+		if (wait <= 0 || !SDL_WaitEventTimeout(&e, wait))
+			break;
+	}
+
+	flush_text(editor);
+	editor_compact_journal(editor);
+	return 1;
+}
+
+/* Make room for at least one more glyph in the batch. */
+static void grow_glyph_batch(void)
+{
+	int new_capacity = glyph_capacity ? glyph_capacity * 2 : 4096;
+
+	glyph_vertices = realloc(glyph_vertices, sizeof(SDL_Vertex) * 4 * new_capacity);
+	glyph_indices = realloc(glyph_indices, sizeof(int) * 6 * new_capacity);
+	if (glyph_vertices == NULL || glyph_indices == NULL)
+		fatal_error("Failed to grow the glyph batch to %d glyphs\n", new_capacity);
+
+	/* Every glyph is a quad made of two triangles. */
+	for (int i = glyph_capacity; i < new_capacity; i++) {
+		int *indices = &glyph_indices[i * 6];
+		indices[0] = i * 4;
+		indices[1] = i * 4 + 1;
+		indices[2] = i * 4 + 2;
+		indices[3] = i * 4 + 2;
+		indices[4] = i * 4 + 1;
+		indices[5] = i * 4 + 3;
+	}
+
+	glyph_capacity = new_capacity;
+}
+
+/* Draw all of the queued glyphs with a single call. */
+static void flush_glyphs(void)
+{
+	if (num_glyphs == 0)
+		return;
+
+	if (SDL_RenderGeometry(renderer, atlas.texture, glyph_vertices, num_glyphs * 4, glyph_indices, num_glyphs * 6) != 0)
+		warning(SDL_GetError());
+	num_glyphs = 0;
+}
+
+static void queue_glyph(int glyph_index, int x, int y, int colour)
+{
+	if (num_glyphs == glyph_capacity)
+		grow_glyph_batch();
+
+	/* Draw what is queued before the atlas slots it uses are given away. */
+	int slot = font_atlas_slot(&atlas, &font, glyph_index);
+	if (slot < 0) {
+		flush_glyphs();
+		font_atlas_clear(&atlas, &font);
+		slot = font_atlas_slot(&atlas, &font, glyph_index);
+	}
+
+	float left = (float)((slot % atlas.columns) * font.width) / atlas.width;
+	float right = (float)((slot % atlas.columns + 1) * font.width) / atlas.width;
+	float top = (float)((slot / atlas.columns) * font.height) / atlas.height;
+	float bottom = (float)((slot / atlas.columns + 1) * font.height) / atlas.height;
+	SDL_Color color = { (colour >> 16) & 0xff, (colour >> 8) & 0xff, colour & 0xff, 0xff };
+
+	SDL_Vertex *vertices = &glyph_vertices[num_glyphs * 4];
+	vertices[0] = (SDL_Vertex){ { x, y }, color, { left, top } };
+	vertices[1] = (SDL_Vertex){ { x + font.width, y }, color, { right, top } };
+	vertices[2] = (SDL_Vertex){ { x, y + font.height }, color, { left, bottom } };
+	vertices[3] = (SDL_Vertex){ { x + font.width, y + font.height }, color, { right, bottom } };
+	num_glyphs++;
+}
+
+/* Queue a string to be drawn in one colour. */
+static void draw_string(const char *str, size_t len, int x, int y, int colour)
+{
+	int glyph_x = x;
+	int glyph_y = y;
 
 	for (int i = 0; i < len; i++) {
-		const char letter = str[i];
+		const unsigned char letter = str[i];
 
 		if (letter == '\n') {
-			dstrect.x = x;
-			dstrect.y += font.height;
+			glyph_x = x;
+			glyph_y += font.height;
+			continue;
+		}
+
+		/* Nothing past the right edge of the window is drawn, up to the next newline. */
+		if (glyph_x >= window_width) {
+			const char *newline = memchr(&str[i], '\n', len - i);
+			if (newline == NULL)
+				break;
+			i = newline - str - 1;
 			continue;
 		}
 
 		if (isspace(letter)) {
-			dstrect.x += font.width;
+			glyph_x += font.width;
 			continue;
 		}
 
 		if (letter == '\0')
 			break;
 
-		int glyph_index = letter;
-		if (font.unicode_desc != NULL)
-			glyph_index = font.unicode_desc[glyph_index];
-		srcrect.x = glyph_index * font.width;
-
-		int colour = current_colour;
-		if (highlight != NULL)
-			colour = editor_syntax_to_colour(highlight[i]);
-
-		if (colour != current_colour) {
-			current_colour = colour;
-			unsigned char r = (colour >> 16) & 0xff;
-			unsigned char g = (colour >> 8) & 0xff;
-			unsigned char b = colour & 0xff;
-			SDL_SetTextureColorMod(font_texture, r, g, b);
+		int glyph_index = font_glyph_index(&font, letter);
+		queue_glyph(glyph_index, glyph_x, glyph_y, colour);
+		glyph_x += font.width;
+	}
+}
+
+/* Clear a part of the current render target to the background colour. */
+static void clear_rect(int x, int y, int w, int h)
+{
+	SDL_Rect rect = { x, y, w, h };
+	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
+	SDL_RenderFillRect(renderer, &rect);
+}
+
+/* Draw the columns of a line of text that are on screen, in the colours of its highlighting. */
+static void draw_highlighted(const char *text, int size, const struct highlight_span *spans, int num_spans,
+		int first_column, int num_columns, int y)
+{
+	if (size > first_column + num_columns)
+		size = first_column + num_columns;
+
+	int start = 0;
+	for (int k = 0; k <= num_spans && start < size; k++) {
+		int end = k < num_spans ? start + spans[k].length : size;
+		int type = k < num_spans ? spans[k].type : HIGHLIGHT_NORMAL;
+		if (end > size)
+			end = size;
+
+		if (end > first_column) {
+			int from = start > first_column ? start : first_column;
+			draw_string(&text[from], end - from, (from - first_column) * font.width, y, editor_syntax_to_colour(type));
 		}
+		start = end;
+	}
+}
+
+/*
+ * Mark a line's search matches on top of its highlighting, starting from the
+ * given match. Only the columns from first_column to the end of the screen are
+ * marked, and the spans start from first_column.
+ */
+static int mark_matches(line_t *line, struct search *search, int match, int first_column, int num_columns)
+{
+	int end_column = first_column + num_columns < line->render_size ? first_column + num_columns : line->render_size;
+	int width = end_column - first_column;
+	if (width <= 0)
+		return 0;
 
-		SDL_RenderCopy(renderer, font_texture, &srcrect, &dstrect);
+	if ((size_t)width > row_highlight_capacity) {
+		row_highlight_capacity = width * 2;
+		row_highlight = realloc(row_highlight, row_highlight_capacity);
+		row_spans = realloc(row_spans, sizeof(struct highlight_span) * row_highlight_capacity);
+		if (row_highlight == NULL || row_spans == NULL)
+			fatal_error("Failed to allocate highlighting for %d columns\n", width);
+	}
+
+	/* Lines that are still being highlighted are drawn without colours, apart from their matches. */
+	memset(row_highlight, HIGHLIGHT_NORMAL, width);
+	if (!line->highlight_dirty) {
+		int start = 0;
+		for (int k = 0; k < line->num_spans && start < end_column; k++) {
+			int end = start + line->spans[k].length;
+			int from = start > first_column ? start : first_column;
+			int to = end < end_column ? end : end_column;
+			if (to > from)
+				memset(&row_highlight[from - first_column], line->spans[k].type, to - from);
+			start = end;
+		}
+	}
 
-		dstrect.x += font.width;
+	/* A line's matches are in order, so the ones past the screen can be left. */
+	int at = search->matches[match].line;
+	for (; match < search->num_matches && search->matches[match].line == at; match++) {
+		int start = row_x_to_display_x(line, search->matches[match].x);
+		if (start >= end_column)
+			break;
+		int end = row_x_to_display_x(line, search->matches[match].x + search->matches[match].length);
+		if (start < first_column)
+			start = first_column;
+		if (end > end_column)
+			end = end_column;
+		if (end > start)
+			memset(&row_highlight[start - first_column], HIGHLIGHT_MATCH, end - start);
 	}
+	return line_encode_spans(row_highlight, width, row_spans);
 }
 
-static void draw_editor(struct editor_state *editor)
+/* Draw the screen rows in the range [first_row, last_row). */
+static void draw_rows(struct editor_state *editor, int first_row, int last_row)
 {
-	int line_y;
+	clear_rect(0, first_row * font.height, window_width, (last_row - first_row) * font.height);
 
-	/* Draw each line of text. */
-	for (int i = 0; i < editor->screen_rows; i++) {
-		line_y = i * font.height;
+	for (int i = first_row; i < last_row; i++) {
+		int line_y = i * font.height;
 
 		if (i + editor->line_offset >= editor->num_lines) {
-			SDL_SetTextureColorMod(font_texture, 0xcc, 0x00, 0xcc);
-			draw_string("~", NULL, 1, 0, line_y);
+			draw_string("~", 1, 0, line_y, 0xcc00cc);
 			continue;
 		}
 
-		line_t *line = &editor->lines[i + editor->line_offset];
+		line_t *line = document_get(&editor->document, i + editor->line_offset);
+		const char *text = line->render;
+		int size = line->render_size;
+		int first_column = editor->col_offset;
+		struct highlight_span *spans = line->spans;
+		int num_spans = line->highlight_dirty ? 0 : line->num_spans;
+
+		/* Matches are marked on the columns being drawn, so that is where the text starts too. */
+		int match = search_find_line(&editor->search, i + editor->line_offset);
+		if (match < editor->search.num_matches && editor->search.matches[match].line == i + editor->line_offset) {
+			if (first_column > size)
+				first_column = size;
+			num_spans = mark_matches(line, &editor->search, match, first_column, editor->screen_cols);
+			spans = row_spans;
+			text += first_column;
+			size -= first_column;
+			first_column = 0;
+		}
 
-		/* Size and length of the text including the scroll offset. */
-		char *printed_text = &line->render[editor->col_offset];
-		unsigned char *printed_highlight = &line->highlight[editor->col_offset];
-		size_t printed_size = line->render_size - editor->col_offset;
-		if (line->render_size >= printed_size)
-			draw_string(printed_text, printed_highlight, printed_size, 0, line_y);
+		draw_highlighted(text, size, spans, num_spans, first_column, editor->screen_cols, line_y);
 	}
+}
 
-	/* Draw the statusline containing file information */
-	struct textbuf statusbuf = textbuf_init();
+/* The name shown in the title bar, so that it is only set again when the file changes. */
+static char *title_filename = NULL;
 
-	editor_draw_status_bar(editor, &statusbuf);
-	editor_draw_message_bar(editor, &statusbuf);
+static void update_title(struct editor_state *editor)
+{
+#define TITLE_BUFSIZE 128
+#define WORKDIR_BUFSIZE 128
+
+	const char *filename = editor->filename ? editor->filename : "[New]";
+	if (title_filename != NULL && strcmp(title_filename, filename) == 0)
+		return;
+	free(title_filename);
+	title_filename = strdup(filename);
 
-	line_y = window_height - (font.height * 2);
-	SDL_SetTextureColorMod(font_texture, 0xff, 0xff, 0xff);
-	draw_string(statusbuf.buffer, NULL, statusbuf.length, 0, line_y);
+	char titlebuf[TITLE_BUFSIZE];
+	char cwdbuf[WORKDIR_BUFSIZE];
+	char *workdir;
+	workdir = getcwd(cwdbuf, WORKDIR_BUFSIZE);
 
-	textbuf_free(&statusbuf);
+	snprintf(titlebuf, TITLE_BUFSIZE, "%s - (%s)", filename, workdir);
+	SDL_SetWindowTitle(window, titlebuf);
 }
 
-void window_redraw(struct editor_state *editor)
+/* Show the latency of each stage in the top right corner, straight onto the window rather than the text layer. */
+static void draw_trace(void)
 {
-	SDL_RenderClear(renderer);
+	char line[80];
+	int length = trace_format_header(line, sizeof(line));
+	int x = window_width - length * font.width;
+	if (x < 0)
+		x = 0;
+
+	clear_rect(x, 0, window_width - x, font.height * (TRACE_NUM_STAGES + 1));
+	draw_string(line, length, x, 0, 0xffff00);
+	for (int stage = 0; stage < TRACE_NUM_STAGES; stage++) {
+		length = trace_format_stage(stage, line, sizeof(line));
+		draw_string(line, length, x, font.height * (stage + 1), 0xffffff);
+	}
+	flush_glyphs();
+}
 
+void window_redraw(struct editor_state *editor)
+{
+	update_screen_size(editor);
+	update_title(editor);
 	editor_scroll(editor);
-	draw_editor(editor);
+
+	/* Build the visible lines and have any that changed highlighted. */
+	for (int i = editor->line_offset; i < editor->line_offset + editor->screen_rows && i < editor->num_lines; i++)
+		editor_render_line(editor, document_get(&editor->document, i));
+	long long start = trace_now();
+	editor_request_highlight(editor);
+	trace_record(TRACE_HIGHLIGHT, start);
+
+	/* Scrolling moves every row, and without a layer nothing is kept. */
+	int redraw_all = text_layer == NULL || !text_layer_valid
+		|| editor->line_offset != drawn_line_offset || editor->col_offset != drawn_col_offset;
+	if (redraw_all) {
+		editor_damage_all(editor);
+		textbuf_clear(&drawn_status);
+	}
+
+	int first_row = editor->damage_start - editor->line_offset;
+	int last_row = editor->damage_end - editor->line_offset;
+	if (first_row < 0)
+		first_row = 0;
+	if (last_row > editor->screen_rows)
+		last_row = editor->screen_rows;
+
+	textbuf_clear(&frame_status);
+	editor_draw_status_bar(editor, &frame_status);
+	editor_draw_message_bar(editor, &frame_status);
+	int status_changed = frame_status.length != drawn_status.length
+		|| memcmp(frame_status.buffer, drawn_status.buffer, frame_status.length) != 0;
 
 	int cursor_x = (editor->cursor_display_x - editor->col_offset);
 	int cursor_y = (editor->cursor_y - editor->line_offset);
@@ -162,6 +534,49 @@ void window_redraw(struct editor_state *editor)
 		cursor_y = editor->screen_rows + 1;
 	}
 
+	/* Leave the window as it is if nothing on it has changed. */
+	int cursor_moved = cursor_x != drawn_cursor_x || cursor_y != drawn_cursor_y;
+	if (first_row >= last_row && !status_changed && !cursor_moved && !needs_present && !show_trace) {
+		trace_input_shown();
+		return;
+	}
+
+	start = trace_now();
+
+	if (text_layer != NULL)
+		SDL_SetRenderTarget(renderer, text_layer);
+	if (redraw_all)
+		SDL_RenderClear(renderer);
+
+	if (first_row < last_row)
+		draw_rows(editor, first_row, last_row);
+
+	/* Draw the statusline containing file information */
+	if (status_changed) {
+		int line_y = window_height - (font.height * 2);
+		clear_rect(0, line_y, window_width, font.height * 2);
+		draw_string(frame_status.buffer, frame_status.length, 0, line_y, 0xffffff);
+	}
+	flush_glyphs();
+
+	struct textbuf previous_status = drawn_status;
+	drawn_status = frame_status;
+	frame_status = previous_status;
+	drawn_line_offset = editor->line_offset;
+	drawn_col_offset = editor->col_offset;
+	drawn_cursor_x = cursor_x;
+	drawn_cursor_y = cursor_y;
+	editor_clear_damage(editor);
+
+	if (text_layer != NULL) {
+		SDL_SetRenderTarget(renderer, NULL);
+		SDL_RenderCopy(renderer, text_layer, NULL, NULL);
+		text_layer_valid = 1;
+	}
+
+	if (show_trace)
+		draw_trace();
+
 	SDL_Rect cursor_rect;
 	cursor_rect.x = cursor_x * font.width;
 	cursor_rect.y = cursor_y * font.height;
@@ -171,36 +586,35 @@ void window_redraw(struct editor_state *editor)
 	SDL_SetRenderDrawColor(renderer, 0x7f, 0x7f, 0x7f, 0xff);
 	SDL_RenderFillRect(renderer, &cursor_rect);
 	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
+	trace_record(TRACE_DRAW, start);
 
+	start = trace_now();
 	SDL_RenderPresent(renderer);
 	SDL_UpdateWindowSurface(window);
-}
-
-void window_set_filename(const char *filename)
-{
-#define TITLE_BUFSIZE 128
-#define WORKDIR_BUFSIZE 128
-
-	char titlebuf[TITLE_BUFSIZE];
-	char cwdbuf[WORKDIR_BUFSIZE];
-	char *workdir;
-	workdir = getcwd(cwdbuf, WORKDIR_BUFSIZE);
-
-	snprintf(titlebuf, TITLE_BUFSIZE, "%s - (%s)", filename, workdir);
-	SDL_SetWindowTitle(window, titlebuf);
-}
-
-void window_get_size(int *rows, int *cols)
-{
-	*cols = window_width / font.width;
-	*rows = window_height / font.height;
+	trace_record(TRACE_PRESENT, start);
+	trace_input_shown();
+	last_present_time = SDL_GetTicks();
+	needs_present = 0;
 }
 
 void window_destroy()
 {
+	highlight_stop();
+	trace_dump();
+
+	free(glyph_vertices);
+	free(glyph_indices);
+	free(row_highlight);
+	free(row_spans);
+	free(title_filename);
+	textbuf_free(&drawn_status);
+	textbuf_free(&frame_status);
+	textbuf_free(&pending_text);
 	font_destroy(&font);
 
-	SDL_DestroyTexture(font_texture);
+	if (text_layer != NULL)
+		SDL_DestroyTexture(text_layer);
+	font_atlas_destroy(&atlas);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 
@@ -4,10 +4,8 @@
 struct editor_state;
 
 void window_init(const char *title, int rows, int cols);
-int window_handle_event(struct editor_state *editor);
+int window_handle_events(struct editor_state *editor);
 void window_redraw(struct editor_state *editor);
-void window_set_filename(const char *filename);
-void window_get_size(int *rows, int *cols);
 void window_destroy();
 
 #endif